@@ -5,12 +5,16 @@
  Licence: Public Domain
 */
 
-static const char * VERSION  = "1.0.3";
-static const char * REV_DATE = "16-Oct-2019";
+static const char * VERSION  = "1.0.7";
+static const char * REV_DATE = "18-Oct-2026";
 
 /*
  Date         Version  Comments
  ----         -------  --------
+ 18-Oct-2026    1.0.7  Add --compress to write a packed binary matrix
+ 18-Oct-2026    1.0.6  Add --index to write a row-offset sidecar for partial loads
+ 18-Oct-2026    1.0.5  Add --structure and --band to generate structured matrices
+ 18-Oct-2026    1.0.4  Add --count to write multi-matrix streams
  16-Oct-2019    1.0.3  Add rand() as alternative to random() and remove srandomdev()
  15-Oct-2019    1.0.2  Add seed facility and Gaussian option to RNG
  14-Oct-2019    1.0.1  Initial release.
@@ -18,9 +22,13 @@ static const char * REV_DATE = "16-Oct-2019";
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h> /* for parsing command line */
 #include <math.h>   /* for the Box-Muller method */
 #include <time.h>   /* for random seeds */
+#include <stdint.h> /* for the fixed size fields of the index */
+#include <sys/stat.h> /* for the size and time of the indexed file */
+#include "mat_pack.h" /* the packed format, shared with mat_test.c */
 
 /*
  This code, 'mat_gen.c' for a simple program that writes a random matrix,
@@ -52,6 +60,41 @@ static const char * REV_DATE = "16-Oct-2019";
  The '--seed N' specification, will use the integer N to seed the random()
  function instead of using the default time-based seeding.
 
+ The '--count N' specification writes N independent random matrices of the
+ same size, one after another, as a stream of repeated 'matrix R C', <DATA>,
+ 'end' blocks below the single pair of comment lines. mat_test processes such
+ streams in batches.
+
+ The '--structure S' specification generates square matrices of a given
+ structure, where S is one of 'general' (the default), 'diagonal', 'upper'
+ and 'lower' (triangular), 'banded', 'symmetric' or 'spd' (symmetric positive
+ definite). Elements outside the structure are written as 0. For 'banded' the
+ '--band K' specification sets how many diagonals above and below the main
+ diagonal are filled (default 1). An 'spd' matrix is made symmetric and
+ strictly diagonally dominant with a positive diagonal. A comment line such as
+
+ # Structure = banded, Bandwidth = 2
+
+ after the version line tells mat_test which structure to expect.
+
+ The '--index K' specification, which needs '--file', also writes a binary
+ sidecar named after the output file with '.idx' added. It holds the byte
+ offset of the start of every Kth row, so that mat_test can seek straight to
+ the rows asked for by '--rows a:b' instead of reading everything before them.
+ The sidecar records the size and modification time of the file it indexes
+ and is ignored if they no longer match. Only a single matrix can be indexed.
+
+ The '--compress' flag writes the matrix in a packed binary form instead of
+ text, which mat_test recognises and reads in the same way as a text file.
+ The values are kept as doubles, in blocks of whole rows of about 256K. Each
+ block has its bytes shuffled, so that byte k of every value in the block
+ comes together, and is then compressed with the LZ77 codec in 'mat_pack.h', which uses
+ the LZ4 sequence format. A block that wouldn't get smaller is stored as it
+ is. The sizes of each block are written in front of it and a table of where
+ the blocks start is written at the end, so that mat_test can unpack blocks
+ in parallel or go straight to the ones it wants. The packed form holds one
+ matrix and no comment lines, so it can't be used with '--count' or '--index'.
+
  When it is available, the POSIX random(3) function is preferable
  to the standard C library rand(3). If your system isn't POSIX compliant
  and random(3) is not available change the definition of 'USE_RAND' below
@@ -77,6 +120,16 @@ static const char * REV_DATE = "16-Oct-2019";
 #  define SRANDOM(X) srandom(X)
 #endif
 
+/* Define where to find the nanoseconds of a file's modification time. The
+   'st_mtim' field only came with POSIX.1-2008, so elsewhere an index records
+   whole seconds. mat_test.c makes the same choice when checking it */
+
+#if defined(_POSIX_C_SOURCE) && ( _POSIX_C_SOURCE >= 200809L )
+#  define MTIME_NSEC(ST) ((ST).st_mtim.tv_nsec)
+#else
+#  define MTIME_NSEC(ST) 0
+#endif
+
 /* Constants defining default behaviour */
 
 static const double DEFAULT_MIN = 0.0;
@@ -85,6 +138,46 @@ static const double DEFAULT_MAX = 1.0;
 /* Flags defining behaviour within this file. */
 
 static int verbose_flg = 0; /* Just an example, not in use. */
+static int compress_flg = 0; /* Write a packed binary matrix instead of text? */
+
+/* Structures that can be generated, in the same order as 'STRUCTURE_NAMES' */
+
+typedef enum {
+    GENERAL = 0,
+    DIAGONAL,
+    UPPER,
+    LOWER,
+    BANDED,
+    SYMMETRIC,
+    SPD,
+    N_STRUCTURES
+} Structure;
+
+static const char * STRUCTURE_NAMES[N_STRUCTURES] = {
+    "general", "diagonal", "upper", "lower", "banded", "symmetric", "spd"
+};
+
+static const long DEFAULT_BAND = 1;
+
+/* Layout of an index sidecar, followed by 'count' 64-bit row offsets. This
+   must match 'struct index_header' in mat_test.c */
+
+#define INDEX_MAGIC "MATIDX1"
+
+typedef struct {
+    char     magic[8];
+    uint64_t every;             /* rows between offsets */
+    uint64_t rows, cols;
+    uint64_t data_size;         /* size of the indexed file */
+    int64_t  data_sec, data_nsec; /* and its modification time */
+    uint64_t count;             /* number of offsets */
+} IndexHeader;
+
+/* Layout of a packed matrix, from 'mat_pack.h' */
+
+typedef struct pack_header PackHeader;
+typedef struct pack_frame  PackFrame;
+typedef struct pack_footer PackFooter;
 
 /* Constants for signalling errors: */
 
@@ -128,6 +221,18 @@ static Error get_string_arg( char **value, const char *opt_name, char *optarg) {
     return NO_ERROR;
 }
 
+/* Read an argument naming a matrix structure */
+static Error get_structure_arg( Structure *value, const char *opt_name, char *optarg) {
+    for (int k = 0; k < N_STRUCTURES; k++) {
+        if (strcmp(optarg, STRUCTURE_NAMES[k]) == 0) {
+            *value = (Structure)k;
+            return NO_ERROR;
+        }
+    }
+    printf ("Error: option -%s has an invalid argument `%s'.\n", opt_name, optarg);
+    return BAD_ARGS;
+}
+
 /* Generate a pseudo random variate from U[min,max] */
 static double uniform(double min, double max) {
     return (RANDOM() / (double)RANDOM_MAX) * (max - min) + min ;
@@ -154,22 +259,98 @@ static double gaussian(void) {
     return spare_value;
 }
 
-/* Generate a random matrix and print it to 'outfile' */
+/* Is element (i,j) inside the given structure, i.e. can it be non-zero? */
+static int in_structure(Structure structure, long band, long i, long j) {
+    switch (structure) {
+        case DIAGONAL: return i == j;
+        case UPPER:    return j >= i;
+        case LOWER:    return j <= i;
+        case BANDED:   return labs(i - j) <= band;
+        default:       return 1;
+    }
+}
+
+/* Pack the 'count' doubles in 'values' into one block and write it to 'outfile' */
+static Error write_block( FILE * outfile, const double * values, size_t count,
+                          unsigned char * shuffled, unsigned char * packed, uint64_t * written ) {
+    PackFrame frame;
+    const unsigned char * data = pack_values( values, count, shuffled, packed, &frame );
+
+    if ( fwrite(&frame, sizeof(frame), 1, outfile) != 1
+      || fwrite(data, 1, frame.packed_size, outfile) != frame.packed_size ) {
+        fprintf(stderr, "Error: Unable to write the packed matrix.\n" );
+        return BAD_FILENAME;
+    }
+    *written += sizeof(frame) + frame.packed_size;
+    return NO_ERROR;
+}
+
+/* Generate 'count' random matrices and print them to 'outfile' */
 static Error print_matrix( FILE * outfile,
                           long rows, long cols,   /* matrix dimensions */
                           double min, double max, /* range for uniform RNG */
                           int normal_flg,         /* generate a Gaussian distribution? */
-                          long seed )             /* RNG seed */
+                          long seed,              /* RNG seed */
+                          long count,             /* number of matrices in the stream */
+                          Structure structure,    /* zero pattern or symmetry to impose */
+                          long band,              /* half-bandwidth for BANDED */
+                          long every,             /* rows between stored offsets */
+                          long * offsets )        /* where to store them, or NULL */
 {
+    double * matrix = NULL; /* whole matrix, only needed for symmetric structures */
+    PackHeader pack;        /* for --compress */
+    double * block = NULL;  /* rows waiting to be packed */
+    unsigned char * shuffled = NULL, * packed = NULL;
+    uint64_t * block_offsets = NULL, written = 0;
+    Error ret_val = NO_ERROR;
+
     if (( rows < 1 ) || ( cols < 1 )) {
         fprintf(stderr, "Error: 'rows' and 'cols' values are missing or invalid.\n" );
         return BAD_ARGS;
     }
+    if ( count < 1 ) {
+        fprintf(stderr, "Error: Value of 'count' must be at least 1.\n" );
+        return BAD_ARGS;
+    }
+    if ( structure != GENERAL && rows != cols ) {
+        fprintf(stderr, "Error: A '%s' matrix must be square.\n", STRUCTURE_NAMES[structure] );
+        return BAD_ARGS;
+    }
+    if ( band < 0 ) {
+        fprintf(stderr, "Error: Value of 'band' must not be negative.\n" );
+        return BAD_ARGS;
+    }
     if (normal_flg == NO && !( min < max )) {
         /* check max and min if a uniform distribution is being used */
         fprintf(stderr, "Error: Value of 'max' is not greater than 'min'.\n" );
         return BAD_ARGS;
     }
+    if ( structure == SYMMETRIC || structure == SPD ) {
+        /* the upper triangle copies the lower one, so the matrix is built first */
+        matrix = malloc( rows * cols * sizeof(double) );
+        if (!matrix) {
+            fprintf(stderr, "Error: Not enough memory for a %ld x %ld matrix.\n", rows, cols );
+            return NO_MEMORY;
+        }
+    }
+    if (compress_flg) {
+        pack_start( &pack, rows, cols );
+        block = malloc( pack.block_rows * cols * sizeof(double) );
+        shuffled = malloc( pack.block_rows * cols * sizeof(double) );
+        packed = malloc( pack.block_rows * cols * sizeof(double) );
+        block_offsets = malloc( pack.blocks * sizeof(uint64_t) );
+        if ( !block || !shuffled || !packed || !block_offsets ) {
+            fprintf(stderr, "Error: Not enough memory to pack a %ld x %ld matrix.\n", rows, cols );
+            ret_val = NO_MEMORY;
+            goto finish;
+        }
+        if ( fwrite( &pack, sizeof(pack), 1, outfile ) != 1 ) {
+            fprintf(stderr, "Error: Unable to write the packed matrix.\n" );
+            ret_val = BAD_FILENAME;
+            goto finish;
+        }
+        written = sizeof(pack);
+    }
     if (seed) {
         /* A non-zero seed was specified as a command line argument */
         SRANDOM((unsigned)seed);
@@ -178,16 +359,124 @@ static Error print_matrix( FILE * outfile,
         SRANDOM( (unsigned)time( NULL ) );
     }
 
-    fprintf( outfile, "matrix %ld %ld\n", rows, cols );
-    for ( int i = 0; i < rows; i++ ) {
-        for ( int j = 0; j < cols; j++ ) {
-            double element_ij = (normal_flg) ? gaussian() : uniform(max, min);
-            fprintf( outfile, "%.12g\t", element_ij );
+    for ( long n = 0; n < count; n++ ) {
+        if (matrix) {
+            for ( long i = 0; i < rows; i++ ) {
+                for ( long j = 0; j <= i; j++ ) {
+                    double element_ij = (normal_flg) ? gaussian() : uniform(max, min);
+                    matrix[i*cols + j] = matrix[j*cols + i] = element_ij;
+                }
+            }
+            if ( structure == SPD ) {
+                /* a diagonal larger than the rest of its row makes it positive definite */
+                for ( long i = 0; i < rows; i++ ) {
+                    double row_sum = 1.0;
+                    for ( long j = 0; j < cols; j++ ) {
+                        if ( j != i ) {
+                            row_sum += fabs( matrix[i*cols + j] );
+                        }
+                    }
+                    matrix[i*cols + i] = row_sum + fabs( matrix[i*cols + i] );
+                }
+            }
+        }
+
+        if (!compress_flg) {
+            fprintf( outfile, "matrix %ld %ld\n", rows, cols );
+        }
+        for ( long i = 0; i < rows; i++ ) {
+            if ( offsets && i % every == 0 ) {
+                offsets[i / every] = ftell( outfile );
+            }
+            for ( long j = 0; j < cols; j++ ) {
+                double element_ij = 0.0;
+                if (matrix) {
+                    element_ij = matrix[i*cols + j];
+                } else if ( in_structure(structure, band, i, j) ) {
+                    element_ij = (normal_flg) ? gaussian() : uniform(max, min);
+                }
+                if (compress_flg) {
+                    block[(i % pack.block_rows)*cols + j] = element_ij;
+                } else {
+                    fprintf( outfile, "%.12g\t", element_ij );
+                }
+            }
+            if (!compress_flg) {
+                fprintf( outfile, "\n" );
+            } else if ( (i + 1) % pack.block_rows == 0 || i == rows - 1 ) {
+                /* a block is full, or this is the last row */
+                block_offsets[i / pack.block_rows] = written;
+                ret_val = write_block(outfile, block, (i % pack.block_rows + 1) * cols, shuffled, packed, &written);
+                if (ret_val != NO_ERROR) {
+                    goto finish;
+                }
+            }
+        }
+        if (!compress_flg) {
+            fprintf( outfile, "end\n" );
+        }
+    }
+
+    if (compress_flg) {
+        /* the table of where each block starts, then where the table starts */
+        PackFooter footer;
+        memset( &footer, 0, sizeof(footer) );
+        footer.table_offset = written;
+        memcpy( footer.magic, PACK_END_MAGIC, sizeof(footer.magic) );
+        if ( fwrite(block_offsets, sizeof(uint64_t), pack.blocks, outfile) != pack.blocks
+          || fwrite(&footer, sizeof(footer), 1, outfile) != 1 ) {
+            fprintf(stderr, "Error: Unable to write the packed matrix.\n" );
+            ret_val = BAD_FILENAME;
         }
-        fprintf( outfile, "\n" );
     }
-    fprintf( outfile, "end\n" );
 
+finish:
+    free(matrix);
+    free(block);
+    free(shuffled);
+    free(packed);
+    free(block_offsets);
+    return ret_val;
+}
+
+/* Write the index sidecar for the file 'data_fname' that has just been closed */
+static Error write_index( const char * data_fname, long rows, long cols, long every, const long * offsets ) {
+    char idx_fname[FILENAME_MAX];
+    struct stat st;
+    IndexHeader header;
+    FILE * idx_fd = NULL;
+    int ok = YES;
+
+    snprintf( idx_fname, sizeof(idx_fname), "%s.idx", data_fname );
+    if ( stat( data_fname, &st ) != 0 ) {
+        fprintf(stderr, "Error: Unable to index file '%s'\n", data_fname );
+        return BAD_FILENAME;
+    }
+    memset( &header, 0, sizeof(header) );
+    strcpy( header.magic, INDEX_MAGIC );
+    header.every = every;
+    header.rows = rows;
+    header.cols = cols;
+    header.data_size = st.st_size;
+    header.data_sec = st.st_mtime;
+    header.data_nsec = MTIME_NSEC( st );
+    header.count = (rows + every - 1) / every;
+
+    idx_fd = fopen( idx_fname, "wb" );
+    if (!idx_fd) {
+        fprintf(stderr, "Error: Unable to open file '%s'\n", idx_fname );
+        return BAD_FILENAME;
+    }
+    ok = ( fwrite( &header, sizeof(header), 1, idx_fd ) == 1 );
+    for ( uint64_t k = 0; ok && k < header.count; k++ ) {
+        uint64_t offset = offsets[k];
+        ok = ( fwrite( &offset, sizeof(offset), 1, idx_fd ) == 1 );
+    }
+    if ( fclose( idx_fd ) != 0 || !ok ) {
+        fprintf(stderr, "Error: Unable to write file '%s'\n", idx_fname );
+        remove( idx_fname );
+        return BAD_FILENAME;
+    }
     return NO_ERROR;
 }
 
@@ -206,12 +495,18 @@ int main(int argc,char ** argv)
     FILE * output_fd = stdout;
     static int normal_flg = NO;
     long seed = 0;
+    long count = 1;
+    Structure structure = GENERAL;
+    long band = DEFAULT_BAND;
+    long every = 0;          /* rows between indexed offsets, 0 for no index */
+    long * offsets = NULL;
 
     while (1) {
         static struct option long_options[] = {
             /* These options set flags. */
             {"verbose", no_argument,      &verbose_flg, 1},
             {"normal", no_argument,       &normal_flg, 1},
+            {"compress", no_argument,     &compress_flg, 1},
             /* These options don’t set a flag the are edistinguished by their indices. */
             {"rows",  required_argument,  0, 'r'},
             {"cols",  required_argument,  0, 'c'},
@@ -219,13 +514,17 @@ int main(int argc,char ** argv)
             {"min",   required_argument,  0, 'L'},
             {"file",  required_argument,  0, 'f'},
             {"seed",  required_argument,  0, 's'},
+            {"count", required_argument,  0, 'n'},
+            {"structure", required_argument, 0, 'S'},
+            {"band",  required_argument,  0, 'b'},
+            {"index", required_argument,  0, 'i'},
             {0, 0, 0, 0}
         };
 
         /* getopt_long needs somewhere to store its option index. */
         int option_index = 0;
 
-        int c = getopt_long( argc, argv, ":vr:c:H:L:f:s:", long_options, &option_index );
+        int c = getopt_long( argc, argv, ":vr:c:H:L:f:s:n:S:b:i:", long_options, &option_index );
 
         /* End of options is signalled with '-1' */
         if (c == -1)
@@ -254,6 +553,18 @@ int main(int argc,char ** argv)
             case 's':
                 ret_val = get_long_arg( &seed, long_options[option_index].name, optarg);
                 break;
+            case 'n':
+                ret_val = get_long_arg( &count, long_options[option_index].name, optarg);
+                break;
+            case 'S':
+                ret_val = get_structure_arg( &structure, long_options[option_index].name, optarg);
+                break;
+            case 'b':
+                ret_val = get_long_arg( &band, long_options[option_index].name, optarg);
+                break;
+            case 'i':
+                ret_val = get_long_arg( &every, long_options[option_index].name, optarg);
+                break;
             case 'H':
                 ret_val = get_double_arg( &max, long_options[option_index].name, optarg);
                 break;
@@ -282,11 +593,23 @@ int main(int argc,char ** argv)
         fprintf (stderr, "\n");
         ret_val = BAD_ARGS;
     }
+    if (compress_flg && ( count != 1 || every )) {
+        fprintf (stderr, "Error: '--compress' writes a single matrix without an index\n");
+        ret_val = BAD_ARGS;
+    } else if (every && ( every < 0 || !output_fname || count != 1 )) {
+        fprintf (stderr, "Error: '--index' needs a positive spacing, '--file' and a single matrix\n");
+        ret_val = BAD_ARGS;
+    } else if (every && rows > 0) {
+        offsets = malloc( ((rows + every - 1) / every) * sizeof(long) );
+        if (!offsets) {
+            ret_val = NO_MEMORY;
+        }
+    }
     if (ret_val != NO_ERROR)
         goto bail_out;
 
     if (output_fname) {
-        output_fd = fopen(output_fname,"w");
+        output_fd = fopen(output_fname, compress_flg ? "wb" : "w");
         if (!output_fd) {
             fprintf (stderr, "Error: Unable to open file '%s'\n", output_fname);
             ret_val = BAD_FILENAME;
@@ -295,15 +618,30 @@ int main(int argc,char ** argv)
     if (ret_val != NO_ERROR)
         goto bail_out;
 
-    fprintf( output_fd, "# ");
-    for ( int arg_no = 0; arg_no  <argc; arg_no++ ) {
-        fprintf(output_fd, "%s ", argv[arg_no]);
+    if (!compress_flg) {
+        fprintf( output_fd, "# ");
+        for ( int arg_no = 0; arg_no  <argc; arg_no++ ) {
+            fprintf(output_fd, "%s ", argv[arg_no]);
+        }
+        fprintf( output_fd, "\n");
+        fprintf( output_fd, "# Version = %s, Revision date = %s\n", VERSION, REV_DATE);
+        if (structure == BANDED) {
+            fprintf( output_fd, "# Structure = %s, Bandwidth = %ld\n", STRUCTURE_NAMES[structure], band);
+        } else if (structure != GENERAL) {
+            fprintf( output_fd, "# Structure = %s\n", STRUCTURE_NAMES[structure]);
+        }
+    }
+    ret_val = print_matrix(output_fd, rows, cols, min, max, normal_flg, seed, count, structure, band, every, offsets);
+    if (ret_val == NO_ERROR && offsets) {
+        /* the index records the finished file, so it is closed first */
+        fclose(output_fd);
+        output_fd = NULL;
+        ret_val = write_index(output_fname, rows, cols, every, offsets);
     }
-    fprintf( output_fd, "\n");
-    fprintf( output_fd, "# Version = %s, Revision date = %s\n", VERSION, REV_DATE);
-    ret_val = print_matrix(output_fd, rows, cols, min, max, normal_flg, seed);
 
 bail_out:
-    fclose(output_fd);
+    if (output_fd)
+        fclose(output_fd);
+    free(offsets);
     return ret_val;
 }
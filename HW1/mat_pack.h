@@ -0,0 +1,285 @@
+/*
+	Title:   Packed matrix format, shared by mat_gen.c and mat_test.c
+	Licence: Public Domain
+*/
+#ifndef MAT_PACK_H
+#define MAT_PACK_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+A packed matrix file is a pack_header, the blocks, a table of the offsets of
+the blocks and a pack_footer giving where the table starts. The values are
+written as doubles in blocks of whole rows, each with a pack_frame in front
+of it. Each block is byte shuffled, so that the first byte of every value
+comes first, then the second byte of every value and so on, and then
+compressed with an LZ77 codec using the same sequence format as LZ4: a token
+byte holding the number of literal bytes and the match length, any longer
+lengths in following bytes of 255 and less, the literals, and the distance
+back to the match in two bytes. A block that wouldn't get smaller is stored
+as it is. The decoder copies in 8 and 16 byte pieces, which may run past
+the end of what is wanted, so the buffers it works in have PACK_SLACK spare
+bytes at the end. Matches close behind are filled with memset for runs of one
+byte, which shuffling makes common, or built from a short repeat and then
+copied 8 bytes at a time.
+
+Everything here is static inline so that each program can include it and be
+built from its one source file as before.
+*/
+
+#define PACK_MAGIC "\x89MATPAK"
+#define PACK_END_MAGIC "MATPEND"
+#define PACK_BLOCK_BYTES (1 << 18) /*aim for blocks of about this much raw data*/
+#define PACK_SLACK 32
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5 /*the last bytes are always literals, as in LZ4*/
+#define LZ_MATCH_LIMIT 12 /*no match starts this near the end*/
+#define LZ_MAX_DISTANCE 65535
+
+/*Start of a packed matrix file, which is followed by the blocks*/
+struct pack_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t value_size;/*bytes in each value, 8 for a double*/
+	uint64_t rows, cols;
+	uint64_t block_rows;/*rows in each block, the last may have fewer*/
+	uint64_t blocks;
+	uint64_t reserved[2];
+};
+
+/*In front of each block, the block is stored as it is if the sizes are the same*/
+struct pack_frame {
+	uint32_t raw_size;
+	uint32_t packed_size;
+};
+
+/*End of a packed matrix file, after the offsets of the blocks*/
+struct pack_footer {
+	uint64_t table_offset;
+	char magic[8];
+};
+
+/*Function fills in the header for a rows x cols matrix, choosing the block size*/
+static inline void pack_start(struct pack_header *h, uint64_t rows, uint64_t cols){
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, PACK_MAGIC, sizeof(h->magic));
+	h->version = 1;
+	h->value_size = sizeof(double);
+	h->rows = rows;
+	h->cols = cols;
+	h->block_rows = PACK_BLOCK_BYTES / (sizeof(double)*cols);
+	if(h->block_rows < 1){
+		h->block_rows = 1;
+	}
+	if(h->block_rows > rows){
+		h->block_rows = rows;
+	}
+	h->blocks = (rows + h->block_rows-1)/h->block_rows;
+}
+
+static inline uint32_t read32(const uint8_t *p){
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline void copy16(uint8_t *d, const uint8_t *s){
+	memcpy(d, s, 16);
+}
+
+/*Function writes a length of 15 or more as bytes of 255 and a last smaller byte*/
+static inline uint8_t *lz_length(uint8_t *op, size_t len){
+	for(len -= 15; len >= 255; len -= 255){
+		*op++ = 255;
+	}
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+/*Function writes one sequence, literals then a match unless mlen is 0*/
+static inline uint8_t *lz_sequence(uint8_t *op, const uint8_t *lit, size_t nlit, size_t dist, size_t mlen){
+	uint8_t *token = op++;
+	*token = (uint8_t)((nlit < 15 ? nlit : 15) << 4);
+	if(nlit >= 15){
+		op = lz_length(op, nlit);
+	}
+	memcpy(op, lit, nlit);
+	op += nlit;
+	if(mlen > 0){
+		*op++ = (uint8_t)dist;
+		*op++ = (uint8_t)(dist >> 8);
+		mlen -= LZ_MIN_MATCH;
+		*token |= (uint8_t)(mlen < 15 ? mlen : 15);
+		if(mlen >= 15){
+			op = lz_length(op, mlen);
+		}
+	}
+	return op;
+}
+
+/*
+Function compresses n bytes into at most cap bytes with a greedy search using
+a hash table of 4 byte sequences. Returns the compressed size, or 0 if it
+would not fit so the block is better stored as it is.
+*/
+static inline size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap){
+	uint32_t *table = calloc(1 << LZ_HASH_BITS, sizeof(uint32_t));
+	uint8_t *op = dst, *end = dst + cap;
+	size_t ip = 0, anchor = 0;
+	size_t limit = (n > LZ_MATCH_LIMIT) ? n - LZ_MATCH_LIMIT : 0;
+	if(table == NULL){
+		return 0;
+	}
+	while(ip < limit){
+		uint32_t seq = read32(src + ip);
+		uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+		size_t ref = table[h];
+		table[h] = (uint32_t)ip;
+		if(ref >= ip || ip - ref > LZ_MAX_DISTANCE || read32(src + ref) != seq){
+			/*step further the longer nothing has matched, so random data is quick*/
+			ip += 1 + ((ip - anchor) >> 6);
+			continue;
+		}
+		size_t mlen = LZ_MIN_MATCH, most = n - LZ_LAST_LITERALS - ip;
+		while(mlen < most && src[ref + mlen] == src[ip + mlen]){
+			mlen++;
+		}
+		size_t nlit = ip - anchor;
+		if((size_t)(end - op) < nlit + nlit/255 + mlen/255 + 8){
+			free(table);
+			return 0;
+		}
+		op = lz_sequence(op, src + anchor, nlit, ip - ref, mlen);
+		ip += mlen;
+		anchor = ip;
+	}
+	size_t nlit = n - anchor;
+	if((size_t)(end - op) < nlit + nlit/255 + 2){
+		free(table);
+		return 0;
+	}
+	op = lz_sequence(op, src + anchor, nlit, 0, 0);
+	free(table);
+	return op - dst;
+}
+
+/*
+Function decompresses n bytes into exactly raw bytes. Both buffers must have
+PACK_SLACK bytes to spare at the end. Returns 0 if the data is broken.
+*/
+static inline int lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t raw){
+	const uint8_t *ip = src, *ip_end = src + n;
+	uint8_t *op = dst, *op_end = dst + raw;
+	while(ip < ip_end){
+		unsigned token = *ip++;
+		size_t nlit = token >> 4;
+		if(nlit == 15){
+			unsigned b;
+			do{
+				if(ip >= ip_end) return 0;
+				b = *ip++;
+				nlit += b;
+			}while(b == 255);
+		}
+		if(nlit > (size_t)(ip_end - ip) || nlit > (size_t)(op_end - op)){
+			return 0;
+		}
+		if(nlit <= 16){
+			copy16(op, ip);
+		}else{
+			memcpy(op, ip, nlit);
+		}
+		op += nlit;
+		ip += nlit;
+		if(ip == ip_end){
+			break;/*the last literals have no match*/
+		}
+		if(ip_end - ip < 2){
+			return 0;
+		}
+		size_t dist = ip[0] | (ip[1] << 8);
+		ip += 2;
+		size_t mlen = token & 15;
+		if(mlen == 15){
+			unsigned b;
+			do{
+				if(ip >= ip_end) return 0;
+				b = *ip++;
+				mlen += b;
+			}while(b == 255);
+		}
+		mlen += LZ_MIN_MATCH;
+		if(dist == 0 || dist > (size_t)(op - dst) || mlen > (size_t)(op_end - op)){
+			return 0;
+		}
+		const uint8_t *match = op - dist;
+		if(dist >= 16){
+			for(size_t k = 0; k < mlen; k += 16){
+				copy16(op + k, match + k);
+			}
+		}else if(dist == 1){
+			memset(op, match[0], mlen);/*runs of one byte are common after shuffling*/
+		}else{
+			/*
+			the first step bytes, a whole number of repeats at least 8 long, are
+			made a byte at a time and the rest copied 8 at a time from step back
+			*/
+			size_t step = dist*((8 + dist-1)/dist);
+			for(size_t k = 0; k < step; k++){
+				op[k] = match[k];
+			}
+			for(size_t k = step; k < mlen; k += 8){
+				memcpy(op + k, op + k - step, 8);
+			}
+		}
+		op += mlen;
+	}
+	return op == op_end;
+}
+
+/*Function gathers byte k of each of the count doubles into the k'th run of count bytes*/
+static inline void shuffle_bytes(const double *values, size_t count, uint8_t *out){
+	const uint8_t *in = (const uint8_t *)values;
+	for(size_t i = 0; i < count; i++){
+		for(int k = 0; k < (int)sizeof(double); k++){
+			out[k*count + i] = in[i*sizeof(double) + k];
+		}
+	}
+}
+
+/*
+Function puts values first to first+len-1 of a shuffled block of count
+doubles back together. Each value is built from its eight bytes with shifts,
+so the loop reads each byte run straight through and vectorises.
+*/
+static inline void unshuffle_bytes(const uint8_t *in, size_t count, size_t first, size_t len, double *out){
+	const uint8_t *b = in + first;
+	for(size_t i = 0; i < len; i++){
+		uint64_t bits = (uint64_t)b[i] | (uint64_t)b[count + i] << 8
+			| (uint64_t)b[2*count + i] << 16 | (uint64_t)b[3*count + i] << 24
+			| (uint64_t)b[4*count + i] << 32 | (uint64_t)b[5*count + i] << 40
+			| (uint64_t)b[6*count + i] << 48 | (uint64_t)b[7*count + i] << 56;
+		memcpy(&out[i], &bits, sizeof(bits));
+	}
+}
+
+/*
+Function shuffles and compresses count doubles into a block, using shuffled
+and packed as work space of count doubles each, and fills in its frame.
+Returns the bytes to write after the frame, which are packed or shuffled.
+*/
+static inline const uint8_t *pack_values(const double *values, size_t count, uint8_t *shuffled, uint8_t *packed, struct pack_frame *frame){
+	shuffle_bytes(values, count, shuffled);
+	frame->raw_size = count*sizeof(double);
+	frame->packed_size = lz_compress(shuffled, frame->raw_size, packed, frame->raw_size - 1);
+	if(frame->packed_size == 0){
+		frame->packed_size = frame->raw_size;
+		return shuffled;
+	}
+	return packed;
+}
+
+#endif
@@ -4,13 +4,30 @@
 	Address: Dept of Physics, University of Exeter, UK
 	Licence: Public Domain
 */
-static const char * VERSION  = "1.0.0";
-static const char * REV_DATE = "05-Nov-20120";
+static const char * VERSION  = "1.12.0";
+static const char * REV_DATE = "18-Oct-2026";
+
+#define _FILE_OFFSET_BITS 64 /*out of core files can be bigger than 2GB*/
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <ctype.h>
+#include <errno.h>
+#include <float.h>
+#include <limits.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "mat_pack.h"
 
 /*
 Code takes input from random matrix generator and performs matrix calculations
@@ -27,17 +44,245 @@ and where fileanme2.txt is only needed in the case of multiplication.
 -d = determinant
 -a = adjoint
 -i = inverse
+-s = solve, finds X in A X = B with A from filename.txt and B from filename2.txt
+-p k = power, finds A^k for a square A and whole number k >= 0, by squaring
+       so only about 2 log2(k) multiplications are needed
+
+If a file holds a stream of several 'matrix R C ... end' blocks (see the
+--count option of mat_gen) then -d, -i and -m work on every block in turn.
+Square blocks from 2x2 to 16x16 are gathered LANES at a time and handed to
+kernels specialised for their size, which work on all the matrices of a batch
+at once. Determinants are printed one per line and result matrices are written
+to the output file as a stream in the same format. For -m the blocks of the
+two files are multiplied in pairs.
+
+Square matrices are checked for structure before -d and -i. Diagonal and
+triangular matrices have their determinant taken from the diagonal and are
+inverted by substitution, symmetric positive definite matrices use a Cholesky
+factorisation, banded matrices an LU factorisation that stays inside the band,
+and anything else a general LU factorisation with partial pivoting. A
+'# Structure = ...' comment line, as written by mat_gen --structure, skips the
+check and the structure it names is used.
+
+Adding --mixed to -i or -s factorises the matrix in double precision, or in
+single precision with --mixed=f32, where the arithmetic is vectorised, and
+then refines the answer with residuals worked out in double-double arithmetic
+until it is as accurate as the long double path. If refinement stalls, for a matrix too
+badly conditioned for the low precision factorisation, the long double path
+is used instead.
+
+--update matrix.txt inverse.txt delta.txt finds the inverse of a matrix after
+a few of its rows or columns have changed, from its old inverse (an output.txt
+of -i) without starting again. The delta file lists the changes as
+
+row i v0 v1 ... vn-1
+col j v0 v1 ... vn-1
+
+giving the new values of row i or column j (counting from 0), in any order,
+optionally finished by 'end'. Lines starting with '#' are comments. For k
+changes the new inverse is found with the Sherman-Morrison-Woodbury formula
+and the new determinant with the matrix determinant lemma in O(k n^2) time.
+A residual check with a probe vector compares the new inverse with the old
+one and if it has lost accuracy the inverse is worked out from scratch. The
+inverse goes to output.txt and the changed matrix to output_updated.txt,
+named after the output file so that nothing else is overwritten. -i notes
+the determinant in a '# Determinant = ...' comment so that it can be updated
+as well, and both it and --update write their results with all their digits.
+
+--workers N spreads -m and -i over N worker processes. The operands are put
+in POSIX shared memory and the workers are sent jobs as fixed size messages
+over Unix sockets: tiles of the product for -m, and for -i the trailing
+updates of a blocked LU factorisation followed by slices of the columns of
+the inverse. The first message to a worker names the shared memory to map,
+so a worker only needs the socket, and the messages hold no pointers.
+
+--index K makes the output file get a binary sidecar, output.txt.idx, holding
+the byte offset of every Kth row (mat_gen --index K does the same for the
+files it writes). --rows a:b and --cols c:d then load only rows a to b-1 and
+columns c to d-1 of the first matrix, counting from 0. When the sidecar is
+there and matches the file, reading seeks straight to the nearest indexed row
+above a instead of scanning every value before it; without it the file is
+scanned as usual. Either range can be left out to take all rows or columns.
+A sidecar indexes a single result matrix, so --index can't be used with --ooc
+or on a file of several matrices.
+
+Any input file can be given as - to read it from stdin, or can be a named
+pipe, so that mat_gen can feed mat_test directly without a file on disk, as in
+./mat_gen -r 500 -c 500 | ./mat_test -m - filename2.txt
+Every input is read once from start to end. For -m the second matrix is read
+first and each row of the product is worked out as soon as the matching row
+of the first matrix has arrived.
+
+--batch manifest.txt --jobs N works through many files in one run, N at a
+time on a pool of threads. Each line of the manifest is one job,
+op input1 [input2] output
+where op is f, t, m, d, a, i, s or pK for the power K (a leading - is
+allowed, so -m works as well as m), input2 is only given for m and s, and
+blank lines and lines starting with # are skipped. Results go to the output
+named on each line rather than output.txt, with -f and -d writing their value
+as a '# Frobenius norm = ...' or '# Determinant = ...' comment. Nothing is
+echoed to the terminal apart from jobs that fail and a count at the end. Each
+thread keeps its matrix buffers from one job to the next. Packed inputs are
+unpacked on the processors left over per job rather than on all of them, so
+N jobs don't start N threads each.
+
+--compress makes the output file a packed binary file instead of text, as
+does mat_gen --compress. It starts with a header giving the size of the
+matrix, then the values as doubles in blocks of whole rows, about 256K each.
+The bytes of each block are shuffled so that byte k of every value comes
+together, which puts the slowly changing sign and exponent bytes next to each
+other, and the block is then compressed with a small LZ77 codec, or stored
+as it is if that doesn't make it smaller. The format and the codec are in
+mat_pack.h, which mat_gen uses as well, so it must be alongside mat_test.c
+when compiling. Every block has its own sizes in front of it and a table of
+where each block starts is at the end, so the blocks are unpacked at the same
+time on several threads and --rows only has to unpack the blocks holding the
+rows asked for. Packed inputs are recognised from their first byte, whatever
+they are called, and can be given anywhere a text file can, including stdin,
+except with --ooc. A packed file holds one matrix, so --compress can't be
+used with --index or --ooc, or on a file of several matrices.
+
+What the format gains is mostly not having to parse text. Values with few
+significant bits, such as whole numbers, pack to a quarter of their size or
+less, but random values with all 53 bits only lose about a tenth, which is
+still half the size of the same values as text with six decimals. On one core of a 2000 x 2000 test,
+unpacking a block to doubles runs at 2 to 3.5 GB/s of doubles, but filling
+the long double matrix (converting each value and touching the new memory)
+takes three quarters of the time, so a whole load runs at about 0.4 GB/s a
+core against 0.03 GB/s for the same matrix as text.
+
+Operands too big for memory can be multiplied (-m) or transposed (-t) out of
+core by adding --ooc, or --mem-limit SIZE to also set how much memory to use
+(a number of bytes, or with a K, M or G suffix, 256M by default). Each text
+input is first turned into a raw binary copy, filename.raw, which is reused on
+later runs while it is newer than the text. The work is then done one square
+tile at a time, with the next tiles read and the last result tile written by a
+separate I/O thread while the current tile is being worked on. The result is
+left in raw form in output.txt.raw and also written out as output.txt.
+Out of core work is done in double precision.
+
+Compile with optimisation so the batch kernels are unrolled and vectorised;
+gcc -O3 -march=native mat_test.c -o mat_test -lm -pthread
 */
 
-int get_size(char *filename, int *size);
-void get_matrix(char *filename, int *size, long double *matrix);
+/*Structures of square matrix that have their own determinant and inverse*/
+enum structure_kind {
+	STRUCT_UNKNOWN = 0,
+	STRUCT_GENERAL,
+	STRUCT_DIAGONAL,
+	STRUCT_UPPER,
+	STRUCT_LOWER,
+	STRUCT_BANDED,
+	STRUCT_SYMMETRIC,
+	STRUCT_SPD,
+	N_STRUCTS
+};
+static const char *struct_names[N_STRUCTS] = {
+	"unknown", "general", "diagonal", "upper", "lower", "banded", "symmetric", "spd"
+};
+
+/*Structure and number of non-zero diagonals below and above the main one*/
+struct shape {
+	enum structure_kind kind;
+	int lower;
+	int upper;
+};
+
+/*An input being read once from start to end, which may be stdin or a pipe*/
+struct input {
+	FILE *fp;
+	char *name;
+	int pending;/*the header of the next block has already been read into size and hint*/
+	int size[2];
+	struct shape hint;
+	int packed;/*is it a packed file rather than text?*/
+	struct pack_header pack;
+	long double det;/*from a '# Determinant = ...' comment in the last header read, or NAN*/
+};
+
+int open_input(struct input *in, char *filename);
+void close_input(struct input *in);
+int get_size(struct input *in, int *size, struct shape *hint);
+int get_matrix(struct input *in, int *size, long double *matrix);
+int more_blocks(struct input *in);
+void echo_matrix(long double *matrix, int *size);
+int unpack_rows(struct input *in, int *range, long double *matrix);
+void write_packed(char *filename, long double *matrix, int *size);
 long double frobenius(long double *matrix1, int *size);
 void transpose(long double *matrix1, long double *tranmatrix, int *size);
 void multiply(long double *matrix1, long double *matrix2, long double *multiplied, int *size1, int *size2);
-long double determinant(long double *matrix, unsigned int rank);
+int multiply_rows(struct input *in, long double *matrix1, long double *matrix2, long double *multiplied, int *size1, int *size2);
+long double *power(long double *matrix, long double *work1, long double *work2, int rank, unsigned long long k);
+long double determinant(long double *matrix, unsigned int rank, struct shape *hint);
 void adjoint(long double *matrix, long double *adjoint_mat, unsigned int rank);
-void inverse(long double *matrix, long double *inverse_mat, unsigned int rank);
+long double inverse(long double *matrix, long double *inverse_mat, unsigned int rank, struct shape *hint);
+void find_shape(long double *matrix, int n, struct shape *hint, struct shape *shape);
 void print_file(long double *matrix, int *size, char *output_file, int argc, char **argv);
+void print_exact_file(long double *matrix, int *size, long double det, char *output_file, int argc, char **argv);
+void print_header(FILE *fp, int argc, char **argv);
+void print_block(FILE *fp, long double *matrix, int *size, int exact);
+int read_header(FILE *fp, int *size, struct shape *hint, long double *det);
+int read_row(FILE *fp, int cols, long double *row);
+int read_end(FILE *fp);
+int read_body(FILE *fp, int *size, long double *matrix);
+int get_part(struct input *in, int *size, int *range, long double *matrix);
+void write_index(char *filename, int *size, long *offsets);
+int run_stream(char op, struct input *in1, struct input *in2, int *first1, long double *matrix1, int *first2, long double *matrix2, long double *first_product, struct shape *first_hint, char *output_file, int argc, char **argv);
+int mixed_solve(long double *a, long double *b, long double *x, int n, int nrhs, int bits);
+void solve(long double *a, long double *b, long double *x, int n, int nrhs);
+int run_update(char *matrix_file, char *inverse_file, char *delta_file, char *output_file, int argc, char **argv);
+int shard_multiply(long double *matrix1, long double *matrix2, long double *multiplied, int *size1, int *size2, int workers);
+int shard_inverse(long double *matrix, long double *inverse_mat, int n, int workers, long double *det);
+int run_out_of_core(char op, char *filename1, char *filename2, char *output_file, long long mem_limit, int argc, char **argv);
+int run_batch(char *manifest_file, int jobs, int argc, char **argv);
+
+/*codes for options that only have a long form*/
+enum {
+	OPT_OOC = 256,
+	OPT_MEM_LIMIT,
+	OPT_MIXED,
+	OPT_UPDATE,
+	OPT_WORKERS,
+	OPT_INDEX,
+	OPT_ROWS,
+	OPT_COLS,
+	OPT_BATCH,
+	OPT_JOBS,
+	OPT_COMPRESS
+};
+
+/*set in --batch mode to stop the reading functions printing to the terminal*/
+static int quiet = 0;
+
+/*threads unpacking each packed input, 0 for one per processor; set by --batch*/
+static int decode_threads = 0;
+
+/*set by --compress to write output files packed*/
+static int compress_flg = 0;
+
+/*rows between the offsets kept in an .idx sidecar when writing, 0 for none*/
+static int index_every = 0;
+
+/*Layout of an .idx sidecar, followed by the offsets of rows 0, K, 2K, ...*/
+#define INDEX_MAGIC "MATIDX1"
+struct index_header {
+	char magic[8];
+	uint64_t every;/*K*/
+	uint64_t rows, cols;
+	uint64_t data_size;/*size and modification time of the indexed file*/
+	int64_t data_sec, data_nsec;
+	uint64_t count;/*number of offsets*/
+};
+
+/*
+Nanoseconds of a file's modification time. st_mtim is only in POSIX.1-2008,
+so without it whole seconds are compared, as mat_gen does when writing.
+*/
+#if defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L
+#define MTIME_NSEC(st) ((st).st_mtim.tv_nsec)
+#else
+#define MTIME_NSEC(st) 0
+#endif
 
 /*
 Main function gets the arguments from command line and calls the appropriate
@@ -48,46 +293,297 @@ to a file, when a matrix is produced.
 int main(int argc,char *argv[]){
 	int size1[2] = {0,0};/*size of matrix1 rows x cols*/
 	char *output_file = {"output.txt"};/*name the output file here*/
+	char op = 0;/*letter of the calculation to carry out*/
+	struct shape hint = {STRUCT_UNKNOWN, 0, 0};/*structure named in the file header*/
+	int ooc_flg = 0;/*work out of core?*/
+	long long mem_limit = 256LL << 20;/*memory allowed for out of core work*/
+	int mixed_bits = 0;/*precision to factorise in for --mixed, 0 if not used*/
+	int workers = 0;/*worker processes for --workers, 0 to work in this one*/
+	int range[4] = {0, -1, 0, -1};/*rows and columns of matrix1 to load, -1 up to the end*/
+	int part_flg = 0;/*only loading part of matrix1?*/
+	unsigned long long exponent = 0;/*k for -p*/
+	char *manifest_file = NULL;/*list of jobs for --batch*/
+	int jobs = 1;/*threads for --batch*/
+
+	static struct option long_options[] = {
+		{"frobenius",   no_argument, 0, 'f'},
+		{"transpose",   no_argument, 0, 't'},
+		{"multiply",    no_argument, 0, 'm'},
+		{"determinant", no_argument, 0, 'd'},
+		{"adjoint",     no_argument, 0, 'a'},
+		{"inverse",     no_argument, 0, 'i'},
+		{"ooc",         no_argument, 0, OPT_OOC},
+		{"mem-limit",   required_argument, 0, OPT_MEM_LIMIT},
+		{"solve",       no_argument, 0, 's'},
+		{"power",       required_argument, 0, 'p'},
+		{"mixed",       optional_argument, 0, OPT_MIXED},
+		{"update",      no_argument, 0, OPT_UPDATE},
+		{"workers",     required_argument, 0, OPT_WORKERS},
+		{"index",       required_argument, 0, OPT_INDEX},
+		{"rows",        required_argument, 0, OPT_ROWS},
+		{"cols",        required_argument, 0, OPT_COLS},
+		{"batch",       required_argument, 0, OPT_BATCH},
+		{"jobs",        required_argument, 0, OPT_JOBS},
+		{"compress",    no_argument, 0, OPT_COMPRESS},
+		{0, 0, 0, 0}
+	};
+	int c;
+	while((c = getopt_long(argc, argv, "ftmdaisp:", long_options, NULL)) != -1){
+		char *end = NULL;
+		switch(c){
+			case OPT_OOC:
+				ooc_flg = 1;
+				break;
+			case OPT_MEM_LIMIT:
+				/*size in bytes with an optional K, M or G suffix, which must fit in a long long*/
+				{
+					int shift = 0;
+					errno = 0;
+					mem_limit = strtoll(optarg, &end, 10);
+					if(*end == 'K' || *end == 'k') shift = 10, end++;
+					else if(*end == 'M' || *end == 'm') shift = 20, end++;
+					else if(*end == 'G' || *end == 'g') shift = 30, end++;
+					if(errno == ERANGE || mem_limit < 0 || mem_limit > (LLONG_MAX >> shift)){
+						mem_limit = 0;
+					}
+					mem_limit <<= shift;
+				}
+				if(*end != '\0' || mem_limit <= 0){
+					printf("Invalid memory limit %s\n", optarg);
+					return 0;
+				}
+				ooc_flg = 1;
+				break;
+			case OPT_MIXED:
+				if(optarg == NULL || strcmp(optarg, "f64") == 0){
+					mixed_bits = 64;
+				}else if(strcmp(optarg, "f32") == 0){
+					mixed_bits = 32;
+				}else{
+					printf("--mixed can be f32 or f64\n");
+					return 0;
+				}
+				break;
+			case OPT_WORKERS:
+				workers = strtol(optarg, &end, 10);
+				if(*end != '\0' || workers < 1){
+					printf("Invalid number of workers %s\n", optarg);
+					return 0;
+				}
+				break;
+			case OPT_INDEX:
+				index_every = strtol(optarg, &end, 10);
+				if(*end != '\0' || index_every < 1){
+					printf("Invalid index spacing %s\n", optarg);
+					return 0;
+				}
+				break;
+			case OPT_ROWS:
+			case OPT_COLS:{
+				/*a:b counting from 0, b not included*/
+				int *r = (c == OPT_ROWS) ? &range[0] : &range[2];
+				r[0] = strtol(optarg, &end, 10);
+				if(*end != ':' || r[0] < 0){
+					printf("Invalid range %s, use a:b\n", optarg);
+					return 0;
+				}
+				r[1] = strtol(end+1, &end, 10);
+				if(*end != '\0' || r[1] <= r[0]){
+					printf("Invalid range %s, use a:b\n", optarg);
+					return 0;
+				}
+				part_flg = 1;
+				break;
+			}
+			case OPT_COMPRESS:
+				compress_flg = 1;
+				break;
+			case OPT_BATCH:
+				manifest_file = optarg;
+				break;
+			case OPT_JOBS:
+				jobs = strtol(optarg, &end, 10);
+				if(*end != '\0' || jobs < 1){
+					printf("Invalid number of jobs %s\n", optarg);
+					return 0;
+				}
+				break;
+			case 'p':
+				exponent = strtoull(optarg, &end, 10);
+				if(*end != '\0' || optarg[0] == '-'){
+					printf("Invalid power %s\n", optarg);
+					return 0;
+				}
+				/*fall through*/
+			case 'f': case 't': case 'm': case 'd': case 'a': case 'i': case 's': case OPT_UPDATE:
+				if(op == 0){
+					op = (c == OPT_UPDATE) ? 'u' : c;/*update is a calculation of its own*/
+					break;
+				}
+				/*only one calculation at a time*/
+				/*fall through*/
+			default:
+				printf("Please choose one calculation, -f -t -m -d -a -i -s or -p\n");
+				return 0;
+		}
+	}
+
+	if(compress_flg && (index_every > 0 || ooc_flg)){
+		printf("--compress can't be used with --index or --ooc\n");
+		return 0;
+	}
+	if(index_every > 0 && ooc_flg){
+		printf("--index can't be used with --ooc\n");
+		return 0;
+	}
 
-	if(argc < 3 || argc >4){
+	if(manifest_file != NULL){
+		if(op != 0 || optind < argc){
+			printf("--batch takes its calculations and files from the manifest\n");
+			return 0;
+		}
+		run_batch(manifest_file, jobs, argc, argv);
+		return 0;
+	}
+
+	/*filenames are whatever is left after the options*/
+	int nfiles = argc - optind;
+	if(op == 0 || nfiles < 1 || nfiles > 3 || (nfiles == 3) != (op == 'u')){
 		printf("please enter valid number of arguments\n");
 		return 0;
 	}
+	if(part_flg && (op == 'u' || ooc_flg)){
+		printf("--rows and --cols can't be used with --update or --ooc\n");
+		return 0;
+	}
+	if(op == 'u'){
+		run_update(argv[optind], argv[optind+1], argv[optind+2], output_file, argc, argv);
+		return 0;
+	}
+	/*check that only used two file names when multiplying*/
+	if((nfiles == 2) != (op == 'm' || op == 's')){
+		printf("Please input function to be used and then filename 1 and filename 2 only if using multiplication or solve.\n");
+		return 0;
+	}
+	if(mixed_bits && op != 'i' && op != 's'){
+		printf("--mixed can only be used with -i and -s\n");
+		return 0;
+	}
+	if(workers && ((op != 'm' && op != 'i') || mixed_bits || ooc_flg)){
+		printf("--workers can only be used with -m and -i, without --mixed or --ooc\n");
+		return 0;
+	}
 
-	char* filename1 = argv[2]; /*retrieve filename from command line arguments*/
+	char* filename1 = argv[optind]; /*retrieve filename from command line arguments*/
+	char* filename2 = (nfiles == 2) ? argv[optind+1] : NULL;
 
-	get_size(filename1, size1);
+	if(ooc_flg){
+		if(op != 'm' && op != 't'){
+			printf("Only -m and -t can be worked out of core\n");
+			return 0;
+		}
+		if(strcmp(filename1, "-") == 0 || (filename2 != NULL && strcmp(filename2, "-") == 0)){
+			printf("Out of core work needs files, not stdin\n");
+			return 0;
+		}
+		run_out_of_core(op, filename1, filename2, output_file, mem_limit, argc, argv);
+		return 0;
+	}
 
-	/*Limited to 12 but could be edited easily enough to add more, but rank 12
-	already takes a long time, so more could take a very long time*/
-	if(size1[0] > 12 || size1[1] > 12){
-		printf("Please make matrix only up to 12 rows/columns");
+	struct input in1, in2;/*each input is opened and read through once*/
+	if(!open_input(&in1, filename1)){
+		return 0;
+	}
+	if(!get_size(&in1, size1, &hint)){
 		return 0;
 	}
+	int full1[2] = {size1[0], size1[1]};/*size of matrix1 in the file*/
+	if(part_flg){
+		/*fill in missing ends and work on the part as if it was the whole matrix*/
+		if(range[1] < 0){
+			range[0] = 0, range[1] = size1[0];
+		}
+		if(range[3] < 0){
+			range[2] = 0, range[3] = size1[1];
+		}
+		if(range[1] > size1[0] || range[3] > size1[1]){
+			printf("Rows %d:%d and columns %d:%d are not all inside the matrix\n", range[0], range[1], range[2], range[3]);
+			return 0;
+		}
+		size1[0] = range[1] - range[0];
+		size1[1] = range[3] - range[2];
+		hint.kind = STRUCT_UNKNOWN;/*a part needn't have the structure of the whole*/
+		printf("Using rows %d:%d and columns %d:%d\n", range[0], range[1], range[2], range[3]);
+	}
+
 	/*
 	create array to store amtrix from file in of appropriatesize=
 	access with elementij = matrix1[cols*i+j];
 	*/
-	long double *matrix1 = malloc(size1[0]*size1[1]*sizeof(long double));
+	long double *matrix1 = malloc((size_t)size1[0]*size1[1]*sizeof(long double));
 
-	get_matrix(filename1, size1, matrix1);
+	/*the second matrix is read first so that -m can start before the first has all arrived*/
+	int size2[2] = {0,0};/*size of matrix2 rows x cols*/
+	long double *matrix2 = NULL;
+	if(filename2 != NULL){
+		if(!open_input(&in2, filename2) || !get_size(&in2, size2, NULL)){
+			return 0;
+		}
+		matrix2 = malloc((size_t)size2[0]*size2[1]*sizeof(long double));
+		if(!get_matrix(&in2, size2, matrix2)){
+			return 0;
+		}
+	}
 
-	/*check that only used two file names when multiplying*/
-	if(argc == 4){
-		if(strcmp(argv[1], "-m") != 0){
-			printf("Please input function to be used and then filename 1 and filename 2 only if using multiplication.\n");
+	long double *multiplied = NULL;/*product for -m, found while matrix1 is read*/
+	int streamed = 0;
+	if(part_flg){
+		if(!get_part(&in1, full1, range, matrix1)){
 			return 0;
 		}
+	}else if(op == 'm' && !workers && size1[1] == size2[0] && !in1.packed){
+		multiplied = malloc((size_t)size1[0]*size2[1]*sizeof(long double));
+		if(!multiply_rows(&in1, matrix1, matrix2, multiplied, size1, size2)){
+			return 0;
+		}
+		streamed = 1;
+	}else if(!get_matrix(&in1, size1, matrix1)){
+		return 0;
+	}
+
+	/*inputs holding more than one matrix are worked through in batches*/
+	if(!part_flg && more_blocks(&in1)){
+		if(op != 'd' && op != 'i' && op != 'm'){
+			printf("Only -d, -i and -m can be used on a file of several matrices\n");
+		}else if(compress_flg || index_every > 0){
+			printf("--compress and --index write a single matrix, not a file of several\n");
+		}else{
+			run_stream(op, &in1, (op == 'm') ? &in2 : NULL, size1, matrix1, size2, matrix2, multiplied, &hint, output_file, argc, argv);
+		}
+		free(matrix1);
+		free(matrix2);
+		free(multiplied);
+		return 0;
+	}
+	close_input(&in1);
+	if(filename2 != NULL){
+		close_input(&in2);
+	}
+
+	/*print matrices to terminal to check they are correct*/
+	echo_matrix(matrix1, size1);
+	if(matrix2 != NULL){
+		echo_matrix(matrix2, size2);
 	}
 
 	/*If frobenius norm chosen run this*/
-	if(strcmp(argv[1], "-f") == 0){
+	if(op == 'f'){
 		long double frob_norm = frobenius(matrix1, size1);
 		printf("Frobenius norm of matrix1 = %LF", frob_norm);
 	}
 
 	/*If transpose chosen run this*/
-	if(strcmp(argv[1], "-t") == 0){
+	if(op == 't'){
 		/*allocate array for the transpose matrix to be stored in*/
 		long double *tranmatrix = malloc(size1[1]*size1[0]*sizeof(long double));
 		transpose(matrix1, tranmatrix, size1);
@@ -107,30 +603,19 @@ int main(int argc,char *argv[]){
 	}
 
 	/*If multiply chosen run this*/
-	if(strcmp(argv[1], "-m") == 0){
-		char *filename2 = argv[3];/*get name of second file*/
-		int size2[2] = {0,0};/*size of matrix2 rows x cols*/
-		get_size(filename2, size2);
-
+	if(op == 'm'){
 		/*check that the calculation is possible*/
 		if(size1[1] != size2[0]){
 			printf("Number of columns of the first matrix must equal the number of rows of the second\n");
 			return 0;
 		}
-
-		/*
-		limit size up to 11, but could edit code to be able to scan in more
-		*/
-		if(size2[0] > 11 || size2[1] > 11){
-			printf("Please make matrix only up to 11 rows/columns");
-		return 0;
+		if(!streamed){
+			/*allocate matrix of coorect size for result of multiplication*/
+			multiplied = malloc(size2[1]*size1[0]*sizeof(long double));
+			if(!workers || !shard_multiply(matrix1, matrix2, multiplied, size1, size2, workers)){
+				multiply(matrix1, matrix2, multiplied, size1, size2);
+			}
 		}
-		/*alloctate space for the second matrix*/
-		long double *matrix2 = malloc(size2[0]*size2[1]*sizeof(long double));
-		get_matrix(filename2, size2, matrix2);
-		/*allocate matrix of coorect size for result of multiplication*/
-		long double *multiplied = malloc(size2[1]*size1[0]*sizeof(long double));
-		multiply(matrix1, matrix2, multiplied, size1, size2);
 
 		/*print matrix in terminal, comment out if not required*/
 		printf("Matrix1 multiplied by matrix2 is;\n");
@@ -141,14 +626,13 @@ int main(int argc,char *argv[]){
 			printf("\n");
 		}
 		/*print to file, tell print_file the size of matrix*/
-		int sizem[2] = {size2[1],size1[0]};
+		int sizem[2] = {size1[0],size2[1]};
 		print_file(multiplied, sizem, output_file, argc, argv);
-		free(matrix2);
 		free(multiplied);
 	}
 
 	/*If determinant chosen run this*/
-	if(strcmp(argv[1], "-d") == 0){
+	if(op == 'd'){
 		if(size1[0] != size1[1]){
 			/*check that a square matrix is input as will not work with others*/
 			printf("Matrix must be square");
@@ -156,12 +640,42 @@ int main(int argc,char *argv[]){
 		}
 		/*make variable that is rank of square matrix*/
 		int rank = size1[0];
-		long double det = determinant(matrix1, rank);
+		struct shape shape;
+		find_shape(matrix1, rank, &hint, &shape);
+		if(shape.kind != STRUCT_GENERAL){
+			printf("Matrix is %s\n", struct_names[shape.kind]);
+		}
+		long double det = determinant(matrix1, rank, &shape);
 		printf("determinant is %LF", det);
 	}
 
+	/*If power chosen run this*/
+	if(op == 'p'){
+		if(size1[0] != size1[1]){
+			printf("Matrix must be square");
+			return 0;
+		}
+		int rank = size1[0];
+		/*the two other buffers used by the squaring besides matrix1*/
+		long double *work1 = malloc((size_t)rank*rank*sizeof(long double));
+		long double *work2 = malloc((size_t)rank*rank*sizeof(long double));
+		long double *powered = power(matrix1, work1, work2, rank, exponent);
+
+		/*print matrix in terminal, comment out if not required*/
+		printf("Matrix1 to the power %llu is;\n", exponent);
+		for(int i = 0; i < rank; i++){
+			for(int j = 0; j < rank; j++){
+				printf("%LF	", powered[rank*i+j]);
+			}
+			printf("\n");
+		}
+		print_file(powered, size1, output_file, argc, argv);
+		free(work1);
+		free(work2);
+	}
+
 	/*If adjoint chosen run this*/
-	if(strcmp(argv[1], "-a") == 0){
+	if(op == 'a'){
 		/*check that a square matrix is input as will not work with others*/
 		if(size1[0] != size1[1]){
 			printf("Matrix must be square");
@@ -188,7 +702,7 @@ int main(int argc,char *argv[]){
 	}
 
 	/*If inverse chosen run this*/
-	if(strcmp(argv[1], "-i") == 0){
+	if(op == 'i'){
 		/*check that a square matrix is input as will not work with others*/
 		if(size1[0] != size1[1]){
 			printf("Matrix must be square");
@@ -198,7 +712,27 @@ int main(int argc,char *argv[]){
 		int rank = size1[0];
 		/*alloctate space for the inverse matrix*/
 		long double *inverse_mat = malloc((rank)*(rank)*sizeof(long double));
-		inverse(matrix1, inverse_mat, rank);
+		long double det = NAN;/*not known when refined*/
+		if(mixed_bits){
+			/*the inverse solves A X = I*/
+			long double *identity = calloc((size_t)rank*rank, sizeof(long double));
+			for(int k = 0; k < rank; k++){
+				identity[rank*k+k] = 1.0;
+			}
+			if(mixed_solve(matrix1, identity, inverse_mat, rank, rank, mixed_bits) < 0){
+				solve(matrix1, identity, inverse_mat, rank, rank);
+			}
+			free(identity);
+		}else if(workers && shard_inverse(matrix1, inverse_mat, rank, workers, &det)){
+			printf("Inverse found by %d workers\n", workers);
+		}else{
+			struct shape shape;
+			find_shape(matrix1, rank, &hint, &shape);
+			if(shape.kind != STRUCT_GENERAL){
+				printf("Matrix is %s\n", struct_names[shape.kind]);
+			}
+			det = inverse(matrix1, inverse_mat, rank, &shape);
+		}
 		/*print matrix in terminal, comment out if not required*/
 		for(int i = 0; i < rank; i++){
 			for(int j = 0; j < rank; j++){
@@ -207,10 +741,36 @@ int main(int argc,char *argv[]){
 			printf("\n");
 		}
 		/*print to file*/
-		print_file(inverse_mat, size1, output_file, argc, argv);
+		print_exact_file(inverse_mat, size1, det, output_file, argc, argv);
+		free(inverse_mat);
+	}
+
+	/*If solve chosen run this*/
+	if(op == 's'){
+		if(size1[0] != size1[1] || size2[0] != size1[0]){
+			printf("Matrix must be square with as many rows as the right hand side\n");
+			return 0;
+		}
+		int rank = size1[0];
+		long double *solution = malloc((size_t)size2[0]*size2[1]*sizeof(long double));
+		if(!mixed_bits || mixed_solve(matrix1, matrix2, solution, rank, size2[1], mixed_bits) < 0){
+			solve(matrix1, matrix2, solution, rank, size2[1]);
+		}
+
+		/*print matrix in terminal, comment out if not required*/
+		printf("Solution is;\n");
+		for(int i = 0; i < size2[0]; i++){
+			for(int j = 0; j < size2[1]; j++){
+				printf("%LF	", solution[size2[1]*i+j]);
+			}
+			printf("\n");
+		}
+		print_file(solution, size2, output_file, argc, argv);
+		free(solution);
 	}
 
 	free(matrix1);
+	free(matrix2);
 	return 0;
 }
 
@@ -220,55 +780,172 @@ int main(int argc,char *argv[]){
 
 
 
-/*Function to open file and read line 3 to get the size of the matrix within the file*/
-int get_size(char *filename, int *size){
-	FILE *fp;
-	int i = 0;
+/*
+Function to skip the comment lines at the top of a matrix block and read the
+'matrix R C' line that gives its size. Returns 1 if a header was found and 0 at
+the end of the file, so it can be called repeatedly on a stream of blocks.
+If hint isn't NULL a '# Structure = ...' comment is stored in it, or
+STRUCT_UNKNOWN if none, and if det isn't NULL a '# Determinant = ...' comment
+is stored there, or NAN if none. Both are only for the block whose header is
+read, so they are cleared first.
+*/
+int read_header(FILE *fp, int *size, struct shape *hint, long double *det){
 	char buffer[200];
-	fp = fopen(filename, "r");
-	/*print error if file can't open*/
-	if (fp == NULL){
-		printf("File could not open %s\n",filename);
-		return 0;
+	if(hint != NULL){
+		hint->kind = STRUCT_UNKNOWN;
+		hint->lower = hint->upper = 0;
 	}
-	/*copies size from line 3 and prints the size of matrix to terminal*/
-	do{i++;
-		if(fgets(buffer, 200 ,fp) != NULL){
-			if(i == 3){
-				sscanf(buffer, "matrix %d %d",&size[0] , &size[1]);
-				printf("%s contains matrix of %d by %d\n",filename, size[0],size[1]);
+	if(det != NULL){
+		*det = NAN;
+	}
+	while(fgets(buffer, sizeof(buffer), fp) != NULL){
+		/*comment lines can be longer than the buffer, so skip to the newline*/
+		int whole_line = (strchr(buffer, '\n') != NULL);
+		if(!whole_line){
+			int ch;
+			while((ch = fgetc(fp)) != EOF && ch != '\n');
+		}
+		if(buffer[0] == '#'){
+			char name[16];
+			int band = -1;
+			if(hint != NULL && sscanf(buffer, "# Structure = %15[a-z], Bandwidth = %d", name, &band) >= 1){
+				for(int k = STRUCT_GENERAL; k < N_STRUCTS; k++){
+					if(strcmp(name, struct_names[k]) == 0){
+						hint->kind = k;
+					}
+				}
+				/*a band without a width has to be found from the matrix*/
+				if(hint->kind == STRUCT_BANDED && band < 0){
+					hint->kind = STRUCT_UNKNOWN;
+				}
+				hint->lower = hint->upper = band;
+			}
+			if(det != NULL){
+				sscanf(buffer, "# Determinant = %Lf", det);
 			}
+			continue;
 		}
-	}while(!feof(fp)&& i <= 3);
-	fclose(fp);
+		if(sscanf(buffer, "matrix %d %d", &size[0], &size[1]) == 2){
+			return 1;
+		}
+	}
+	return 0;
 }
 
-/*Function extracts the matrix from the file and stores it in the size array*/
-void get_matrix(char *filename, int *size, long double *matrix){
-	FILE *fp;
-	fp = fopen(filename, "r");
-	int i = 0;
-	char buffer[200];
-	/*
-	Goes to line 4 onward and scans the matrix into memory,
-	This could definitely be better but could not figure out how to get it
-	working in limited time, so this works up to 12 columns,
-	could edit to add more, but calcculations will be very slow.
-	*/
+/*Function reads the next cols values, returning 0 if there are too few*/
+int read_row(FILE *fp, int cols, long double *row){
+	for(int j = 0; j < cols; j++){
+		if(fscanf(fp, "%Lf", &row[j]) != 1){
+			return 0;
+		}
+	}
+	return 1;
+}
 
-	do{i++;
-		if(fgets(buffer, 200 ,fp) != NULL){
-			if(i >= 4 && i <= size[0]+3){
-				sscanf(buffer,"%LF %LF %LF %LF %LF %LF %LF %LF %LF %LF %LF %LF",
-				&matrix[size[1]*(i-4)+0],&matrix[size[1]*(i-4)+1],&matrix[size[1]*(i-4)+2],
-				&matrix[size[1]*(i-4)+3],&matrix[size[1]*(i-4)+4],&matrix[size[1]*(i-4)+5],
-				&matrix[size[1]*(i-4)+6],&matrix[size[1]*(i-4)+7],&matrix[size[1]*(i-4)+8],
-				&matrix[size[1]*(i-4)+9],&matrix[size[1]*(i-4)+10],&matrix[size[1]*(i-4)+11] );
-			}
+/*Function reads the 'end' line that closes a block, returning 0 if it is missing*/
+int read_end(FILE *fp){
+	char word[8];
+	return fscanf(fp, " %7s", word) == 1 && strcmp(word, "end") == 0;
+}
+
+/*
+Function reads the rows x cols values following a header and the 'end' line
+that closes the block. Values may be split over lines in any way, so there is
+no limit on the number of columns. Returns 0 if the block is short or broken.
+*/
+int read_body(FILE *fp, int *size, long double *matrix){
+	for(int i = 0; i < size[0]; i++){
+		if(!read_row(fp, size[1], matrix + (size_t)size[1]*i)){
+			return 0;
+		}
+	}
+	return read_end(fp);
+}
+
+/*Function opens a file to read, or uses stdin if the name is -*/
+int open_input(struct input *in, char *filename){
+	in->name = filename;
+	in->pending = 0;
+	in->hint.kind = STRUCT_UNKNOWN;
+	in->det = NAN;
+	in->fp = (strcmp(filename, "-") == 0) ? stdin : fopen(filename, "r");
+	if(in->fp == NULL){
+		printf("File could not open %s\n", filename);
+		return 0;
+	}
+	/*a packed file starts with a byte that is never found in text*/
+	int ch = getc(in->fp);
+	in->packed = (ch == (unsigned char)PACK_MAGIC[0]);
+	ungetc(ch, in->fp);
+	return 1;
+}
+
+void close_input(struct input *in){
+	if(in->fp != NULL && in->fp != stdin){
+		fclose(in->fp);
+	}
+	in->fp = NULL;
+}
+
+/*
+Function reads the header of the next block to get the size of the matrix in it,
+or takes the one already read by more_blocks
+*/
+int get_size(struct input *in, int *size, struct shape *hint){
+	/*copies size from the header and prints the size of matrix to terminal*/
+	if(in->packed){
+		struct pack_header *h = &in->pack;
+		if(fread(h, sizeof(*h), 1, in->fp) != 1 || memcmp(h->magic, PACK_MAGIC, sizeof(h->magic)) != 0
+		|| h->version != 1 || h->value_size != sizeof(double) || h->rows < 1 || h->cols < 1
+		|| h->rows > INT32_MAX || h->cols > INT32_MAX || h->block_rows < 1 || h->block_rows > h->rows
+		|| h->block_rows*h->cols > UINT32_MAX/sizeof(double)
+		|| h->blocks != (h->rows + h->block_rows-1)/h->block_rows){
+			printf("File %s is not a whole packed matrix\n", in->name);
+			return 0;
+		}
+		size[0] = h->rows, size[1] = h->cols;
+	}else if(in->pending){
+		size[0] = in->size[0], size[1] = in->size[1];
+		if(hint != NULL){
+			*hint = in->hint;
 		}
-	}while(!feof(fp));
+		in->pending = 0;
+	}else if(!read_header(in->fp, size, hint, &in->det) || size[0] < 1 || size[1] < 1){
+		printf("File %s does not contain a matrix\n", in->name);
+		return 0;
+	}
+	if(!quiet){
+		printf("%s contains matrix of %d by %d\n", in->name, size[0], size[1]);
+	}
+	return 1;
+}
+
+/*Function reads the values of the matrix whose header was just read, returning 0 if it can't*/
+int get_matrix(struct input *in, int *size, long double *matrix){
+	if(in->packed){
+		int range[4] = {0, size[0], 0, size[1]};
+		return unpack_rows(in, range, matrix);
+	}
+	if(!read_body(in->fp, size, matrix)){
+		printf("Could not read matrix from %s\n", in->name);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+Function looks past the block just read for the header of another one, which
+is kept for the next get_size. Returns 1 if there is another block.
+*/
+int more_blocks(struct input *in){
+	if(!in->pending && !in->packed){
+		in->pending = read_header(in->fp, in->size, &in->hint, &in->det) && in->size[0] > 0 && in->size[1] > 0;
+	}
+	return in->pending;
+}
 
-	/*print matrix to terminal to check it is correct*/
+/*Function prints a matrix to the terminal*/
+void echo_matrix(long double *matrix, int *size){
 	for(int x = 0; x < size[0]; x++){
 		for(int y = 0; y < size[1]; y++){
 			printf("%LF ", matrix[size[1]*x+y]);
@@ -276,7 +953,6 @@ void get_matrix(char *filename, int *size, long double *matrix){
 		printf("\n");
 	}
 	printf("\n");
-	fclose(fp);
 }
 
 /*
@@ -312,112 +988,3347 @@ multiplying and adding appropriately and placing in new array.*/
 void multiply(long double *matrix1, long double *matrix2, long double *multiplied, int *size1, int *size2){
 	for(int i = 0; i < size1[0]; i++){
 		for(int j = 0; j < size2[1]; j++){
+			long double sum = 0.0;
 			for(int k = 0; k < size1[1]; k++){
-				multiplied[size2[1]*i+j] += matrix1[size1[1]*i+k] * matrix2[size2[1]*k+j];
+				sum += matrix1[size1[1]*i+k] * matrix2[size2[1]*k+j];
 			}
+			multiplied[size2[1]*i+j] = sum;
 		}
 	}
 }
 
-/*Function calculates the determinant of an input matrix (recursivelly if rank > 2) and returns it*/
-long double determinant(long double *matrix, unsigned int rank){
-	long double det = 0.0;
-	/*1x1 matrix just return value*/
-	if(rank == 1){
-		det = matrix[0];
+/*
+Function multiplies like multiply() but reads matrix1 from the input as it
+goes, working out each row of the product as soon as the same row of matrix1
+has been read. matrix2 must already be loaded. Returns 0 if matrix1 is broken.
+*/
+int multiply_rows(struct input *in, long double *matrix1, long double *matrix2, long double *multiplied, int *size1, int *size2){
+	int one_row[2] = {1, size1[1]};
+	for(int i = 0; i < size1[0]; i++){
+		long double *row1 = matrix1 + (size_t)size1[1]*i;
+		if(!read_row(in->fp, size1[1], row1)){
+			printf("Could not read matrix from %s\n", in->name);
+			return 0;
+		}
+		multiply(row1, matrix2, multiplied + (size_t)size2[1]*i, one_row, size2);
 	}
-	/*Calculation for a 2x2 matrix, final step in recursive calls*/
-	if(rank == 2){
-		det = matrix[rank*0+0] * matrix[rank*1+1] - matrix[rank*1+0] * matrix[rank*0+1];
+	if(!read_end(in->fp)){
+		printf("Could not read matrix from %s\n", in->name);
+		return 0;
 	}
-	/*Calls itself recursively until rank is 2*/
-	if(rank > 2){
-		long double *cofactor = malloc((rank-1)*(rank-1)*sizeof(long double));
-		/*iterate over j from 1 to rank to leave out j=0,
-		keep k 0 so that the first row is removed*/
+	return 1;
+}
+
+/*
+Function raises a square matrix to the power k by repeated squaring, using
+only the matrix and two work buffers of the same size and no others. The
+buffers are swapped round rather than copied after each multiplication, so the
+contents of all three are lost and a pointer to whichever of them holds the
+result is returned.
+*/
+long double *power(long double *matrix, long double *work1, long double *work2, int rank, unsigned long long k){
+	int size[2] = {rank, rank};
+	long double *base = matrix;/*matrix^(2^bit)*/
+	long double *result = work1;/*product of the powers for the bits seen so far*/
+	long double *spare = work2;/*where the next product goes*/
+	long double *swap;
+	int started = 0;/*has result been set yet?*/
+
+	if(k == 0){
+		for(int i = 0; i < rank*rank; i++){
+			result[i] = 0.0;
+		}
 		for(int i = 0; i < rank; i++){
-			for(int j = 1; j < rank; j++){
-				int k = 0;
-				for(int l = 0; l < rank; l++){
-					if(l == i)continue;/*if l is the same as i skip putting it in cofactor matrix*/
-					cofactor[(rank-1)*(j-1)+k] = matrix[rank*j+l];
-					k++;
-				}
+			result[rank*i+i] = 1.0;
+		}
+		return result;
+	}
+	while(k > 0){
+		if(k & 1){
+			if(started){
+				multiply(result, base, spare, size, size);
+				swap = result, result = spare, spare = swap;
+			}else{
+				/*first bit set, result starts as the current base*/
+				memcpy(result, base, (size_t)rank*rank*sizeof(long double));
+				started = 1;
 			}
-			det += pow(-1, i)*matrix[rank*0+i]*determinant(cofactor,rank-1);/*-1 to the power of i as k kept at 0*/
 		}
-		free(cofactor);
+		k >>= 1;
+		if(k > 0){
+			multiply(base, base, spare, size, size);
+			swap = base, base = spare, spare = swap;
+		}
 	}
-	return det;
+	return result;
 }
 
-/*Find the adjoint of input matrix and return passed array*/
-void adjoint(long double *matrix, long double *adjoint_mat, unsigned int rank){
-	if(rank == 1){
-		adjoint_mat[rank*0+0] = 1.0;
-
-	}else if(rank > 1){
-		long double *cofactor = malloc((rank-1)*(rank-1)*sizeof(long double));
-		/*cycle through input matrix*/
-		for(int i = 0; i < rank; i++){
-			for(int j = 0; j < rank; j++){
-				/*increase x when at end of row and y after each column*/
-				int x = 0, y = 0;
-				for(int k = 0; k < rank; k++){
-					for(int l = 0; l < rank; l++){
-						if(k != i && l != j){/*fill cofactor leaving ot row and column currently in*/
-							cofactor[(rank-1)*x+y] = matrix[rank*k+l];
-							y++;
-							if(x == rank-1){/*reset y to zero at end of each row*/
-								y = 0;
-								x++;
-							}
-						}
-					}
-				}
+/*
+Function finds the structure of a square matrix from its zero pattern in
+O(n^2) time. A structure named in the file header is taken as it is.
+*/
+void find_shape(long double *matrix, int n, struct shape *hint, struct shape *shape){
+	if(hint != NULL && hint->kind != STRUCT_UNKNOWN){
+		*shape = *hint;
+		/*fill in the bandwidths the structure implies*/
+		int wide = (shape->kind == STRUCT_UPPER || shape->kind == STRUCT_DIAGONAL) ? 0 : n-1;
+		int tall = (shape->kind == STRUCT_LOWER || shape->kind == STRUCT_DIAGONAL) ? 0 : n-1;
+		if(shape->kind != STRUCT_BANDED || shape->lower > n-1){
+			shape->lower = wide;
+			shape->upper = tall;
+		}
+		if(shape->kind == STRUCT_BANDED && shape->upper > n-1){
+			shape->upper = n-1;
+		}
+		return;
+	}
 
-				adjoint_mat[(rank)*j+i] = pow(-1, i+j)*determinant(cofactor, rank-1);
+	/*furthest non-zero element below and above the diagonal*/
+	int lower = 0, upper = 0;
+	for(int i = 0; i < n; i++){
+		for(int j = 0; j < n; j++){
+			if(matrix[n*i+j] != 0.0){
+				if(i-j > lower) lower = i-j;
+				if(j-i > upper) upper = j-i;
+			}
+		}
+	}
+	shape->lower = lower;
+	shape->upper = upper;
 
+	if(lower == 0 && upper == 0){
+		shape->kind = STRUCT_DIAGONAL;
+	}else if(lower == 0){
+		shape->kind = STRUCT_UPPER;
+	}else if(upper == 0){
+		shape->kind = STRUCT_LOWER;
+	}else{
+		int symmetric = (lower == upper);
+		for(int i = 0; i < n && symmetric; i++){
+			for(int j = 0; j < i; j++){
+				if(matrix[n*i+j] != matrix[n*j+i]){
+					symmetric = 0;
+					break;
+				}
 			}
 		}
-		free(cofactor);
+		/*whether it is positive definite is only found by trying Cholesky*/
+		if(symmetric){
+			shape->kind = STRUCT_SYMMETRIC;
+		}else if(2*(lower+upper) < n){
+			shape->kind = STRUCT_BANDED;
+		}else{
+			shape->kind = STRUCT_GENERAL;
+		}
 	}
 }
 
+/*A band LU only pays off when the band is narrow compared to the matrix*/
+static int narrow_band(struct shape *shape, int n){
+	return 2*(shape->lower + shape->upper) < n;
+}
+
 /*
-Function takes in matrix, finds determinan tand adjoint matrix,
-then multiplies 1/determinant * adjoint to find inverse
+Function does an LU factorisation with partial pivoting in place, leaving L
+(with its unit diagonal left out) below the diagonal and U on and above it.
+perm[k] is the row swapped with row k at step k. Returns the sign of the row
+permutation, a 0 on the diagonal of U means the matrix is singular.
 */
-void inverse(long double *matrix, long double *inverse_mat, unsigned int rank){
-	long double det = determinant(matrix, rank);
-	long double *adjoint_mat = malloc((rank)*(rank)*sizeof(long double));
-	adjoint(matrix, adjoint_mat, rank);
-	for(int i = 0; i < rank; i++){
-		for(int j = 0; j < rank; j++){
-			inverse_mat[rank*i+j] = 1/det*adjoint_mat[rank*i+j];
+static int lu_factor(long double *lu, int *perm, int n){
+	int sign = 1;
+	for(int k = 0; k < n; k++){
+		int p = k;
+		long double best = fabsl(lu[n*k+k]);
+		for(int i = k+1; i < n; i++){
+			if(fabsl(lu[n*i+k]) > best){
+				best = fabsl(lu[n*i+k]);
+				p = i;
+			}
+		}
+		perm[k] = p;
+		if(p != k){
+			for(int j = 0; j < n; j++){
+				long double t = lu[n*k+j];
+				lu[n*k+j] = lu[n*p+j];
+				lu[n*p+j] = t;
+			}
+			sign = -sign;
+		}
+		long double piv = lu[n*k+k];
+		if(piv == 0.0){
+			continue;
+		}
+		for(int i = k+1; i < n; i++){
+			long double f = lu[n*i+k]/piv;
+			lu[n*i+k] = f;
+			if(f == 0.0){
+				continue;
+			}
+			for(int j = k+1; j < n; j++){
+				lu[n*i+j] -= f*lu[n*k+j];
+			}
 		}
 	}
-	free(adjoint_mat);
+	return sign;
 }
 
-/*Function to print a file of the result matrix in the same format as imput*/
-void print_file(long double *matrix, int *size, char *output_file, int argc, char **argv){
-	FILE *fp;
-	fp = fopen(output_file,"w");
-	fprintf(fp, "# ");
-	for(int i = 0; i < argc; i++){
-		fprintf(fp, "%s ", argv[i]);
+/*Function solves A x = b in place using lu_factor's result, b is n x nrhs*/
+static void lu_solve(long double *lu, int *perm, int n, long double *b, int nrhs){
+	for(int k = 0; k < n; k++){
+		if(perm[k] != k){
+			for(int j = 0; j < nrhs; j++){
+				long double t = b[nrhs*k+j];
+				b[nrhs*k+j] = b[nrhs*perm[k]+j];
+				b[nrhs*perm[k]+j] = t;
+			}
+		}
 	}
-	fprintf(fp, "\n");
-	fprintf(fp, "# Version = %s, Revision date = %s\n", VERSION, REV_DATE);
-	fprintf(fp, "matrix %d %d\n", size[0], size[1]);
-	for(int j = 0; j < size[0]; j++){
-		for(int k = 0; k < size[1]; k++){
-			fprintf(fp, "%LF	", matrix[size[1]*j+k]);
+	for(int k = 0; k < n; k++){
+		for(int i = k+1; i < n; i++){
+			long double f = lu[n*i+k];
+			if(f == 0.0){
+				continue;
+			}
+			for(int j = 0; j < nrhs; j++){
+				b[nrhs*i+j] -= f*b[nrhs*k+j];
+			}
 		}
-		fprintf(fp, "\n");
 	}
-	fprintf(fp, "end\n");
-
-	fclose(fp);
+	for(int k = n-1; k >= 0; k--){
+		long double rcp = 1.0/lu[n*k+k];
+		for(int j = 0; j < nrhs; j++){
+			b[nrhs*k+j] *= rcp;
+		}
+		for(int i = 0; i < k; i++){
+			long double f = lu[n*i+k];
+			if(f == 0.0){
+				continue;
+			}
+			for(int j = 0; j < nrhs; j++){
+				b[nrhs*i+j] -= f*b[nrhs*k+j];
+			}
+		}
+	}
+}
+
+/*
+Band storage: column j of the matrix is column j of ab, with element ij at row
+kl+ku+i-j. The extra kl rows on top hold the fill-in caused by row swaps, so
+ab is (2kl+ku+1) x n rather than n x n.
+*/
+#define BAND(i, j) ab[(2*kl+ku+1)*(j) + kl+ku+(i)-(j)]
+
+/*Function copies the band of a square matrix into band storage*/
+static long double *band_copy(long double *matrix, int n, int kl, int ku){
+	long double *ab = calloc((size_t)(2*kl+ku+1)*n, sizeof(long double));
+	for(int j = 0; j < n; j++){
+		int top = (j-ku > 0) ? j-ku : 0;
+		int bottom = (j+kl < n-1) ? j+kl : n-1;
+		for(int i = top; i <= bottom; i++){
+			BAND(i, j) = matrix[n*i+j];
+		}
+	}
+	return ab;
+}
+
+/*
+Function does an LU factorisation with partial pivoting of a matrix in band
+storage, only ever touching elements inside the band so it costs O(n kl (kl+ku))
+instead of O(n^3). Returns the sign of the row permutation.
+*/
+static int band_factor(long double *ab, int *perm, int n, int kl, int ku){
+	int sign = 1;
+	for(int k = 0; k < n; k++){
+		int last = (k+kl < n-1) ? k+kl : n-1;
+		int right = (k+kl+ku < n-1) ? k+kl+ku : n-1;
+		int p = k;
+		long double best = fabsl(BAND(k, k));
+		for(int i = k+1; i <= last; i++){
+			if(fabsl(BAND(i, k)) > best){
+				best = fabsl(BAND(i, k));
+				p = i;
+			}
+		}
+		perm[k] = p;
+		if(p != k){
+			for(int j = k; j <= right; j++){
+				long double t = BAND(k, j);
+				BAND(k, j) = BAND(p, j);
+				BAND(p, j) = t;
+			}
+			sign = -sign;
+		}
+		long double piv = BAND(k, k);
+		if(piv == 0.0){
+			continue;
+		}
+		for(int i = k+1; i <= last; i++){
+			long double f = BAND(i, k)/piv;
+			BAND(i, k) = f;
+			for(int j = k+1; j <= right; j++){
+				BAND(i, j) -= f*BAND(k, j);
+			}
+		}
+	}
+	return sign;
+}
+
+/*Function solves A x = b in place using band_factor's result, b is n x nrhs*/
+static void band_solve(long double *ab, int *perm, int n, int kl, int ku, long double *b, int nrhs){
+	/*row swaps were not applied to earlier columns of L, so they are done as we go*/
+	for(int k = 0; k < n; k++){
+		if(perm[k] != k){
+			for(int j = 0; j < nrhs; j++){
+				long double t = b[nrhs*k+j];
+				b[nrhs*k+j] = b[nrhs*perm[k]+j];
+				b[nrhs*perm[k]+j] = t;
+			}
+		}
+		int last = (k+kl < n-1) ? k+kl : n-1;
+		for(int i = k+1; i <= last; i++){
+			long double f = BAND(i, k);
+			for(int j = 0; j < nrhs; j++){
+				b[nrhs*i+j] -= f*b[nrhs*k+j];
+			}
+		}
+	}
+	for(int k = n-1; k >= 0; k--){
+		long double rcp = 1.0/BAND(k, k);
+		for(int j = 0; j < nrhs; j++){
+			b[nrhs*k+j] *= rcp;
+		}
+		int top = (k-kl-ku > 0) ? k-kl-ku : 0;
+		for(int i = top; i < k; i++){
+			long double f = BAND(i, k);
+			for(int j = 0; j < nrhs; j++){
+				b[nrhs*i+j] -= f*b[nrhs*k+j];
+			}
+		}
+	}
+}
+
+#undef BAND
+
+/*Packed storage of a lower triangle, only n(n+1)/2 elements*/
+#define PACKED(i, j) ((long)(i)*((i)+1)/2 + (j))
+
+/*
+Function does a Cholesky factorisation A = L L^T of a symmetric matrix into
+packed storage. Returns 0 if the matrix turns out not to be positive definite.
+*/
+static int cholesky(long double *matrix, long double *l, int n){
+	for(int i = 0; i < n; i++){
+		for(int j = 0; j <= i; j++){
+			long double sum = matrix[n*i+j];
+			for(int k = 0; k < j; k++){
+				sum -= l[PACKED(i, k)]*l[PACKED(j, k)];
+			}
+			if(i == j){
+				if(!(sum > 0.0)){
+					return 0;
+				}
+				l[PACKED(i, i)] = sqrtl(sum);
+			}else{
+				l[PACKED(i, j)] = sum/l[PACKED(j, j)];
+			}
+		}
+	}
+	return 1;
+}
+
+/*Function inverts a packed lower triangular matrix into a second packed one*/
+static void packed_lower_inverse(long double *l, long double *x, int n){
+	for(int j = 0; j < n; j++){
+		x[PACKED(j, j)] = 1.0/l[PACKED(j, j)];
+		for(int i = j+1; i < n; i++){
+			long double sum = 0.0;
+			for(int k = j; k < i; k++){
+				sum += l[PACKED(i, k)]*x[PACKED(k, j)];
+			}
+			x[PACKED(i, j)] = -sum/l[PACKED(i, i)];
+		}
+	}
+}
+
+/*Function inverts a triangular matrix by substitution, the inverse has the same shape*/
+static void triangular_inverse(long double *matrix, long double *inverse_mat, int n, int upper){
+	for(int i = 0; i < n*n; i++){
+		inverse_mat[i] = 0.0;
+	}
+	for(int j = 0; j < n; j++){
+		inverse_mat[n*j+j] = 1.0/matrix[n*j+j];
+		if(upper){
+			for(int i = j-1; i >= 0; i--){
+				long double sum = 0.0;
+				for(int k = i+1; k <= j; k++){
+					sum += matrix[n*i+k]*inverse_mat[n*k+j];
+				}
+				inverse_mat[n*i+j] = -sum/matrix[n*i+i];
+			}
+		}else{
+			for(int i = j+1; i < n; i++){
+				long double sum = 0.0;
+				for(int k = j; k < i; k++){
+					sum += matrix[n*i+k]*inverse_mat[n*k+j];
+				}
+				inverse_mat[n*i+j] = -sum/matrix[n*i+i];
+			}
+		}
+	}
+}
+
+/*
+Function calculates the determinant of an input matrix and returns it, using
+the cheapest method its structure allows. hint may be NULL, when the
+structure is found from the matrix.
+*/
+long double determinant(long double *matrix, unsigned int rank, struct shape *hint){
+	int n = rank;
+	struct shape shape;
+	long double det = 1.0;
+	find_shape(matrix, n, hint, &shape);
+
+	/*triangular matrices have the product of the diagonal as determinant*/
+	if(shape.kind == STRUCT_DIAGONAL || shape.kind == STRUCT_UPPER || shape.kind == STRUCT_LOWER){
+		for(int k = 0; k < n; k++){
+			det *= matrix[n*k+k];
+		}
+		return det;
+	}
+	/*det(A) = det(L)^2 when A is positive definite*/
+	if(shape.kind == STRUCT_SYMMETRIC || shape.kind == STRUCT_SPD){
+		long double *l = malloc(PACKED(n, 0)*sizeof(long double));
+		int positive = cholesky(matrix, l, n);
+		for(int k = 0; k < n && positive; k++){
+			det *= l[PACKED(k, k)]*l[PACKED(k, k)];
+		}
+		free(l);
+		if(positive){
+			return det;
+		}
+	}
+
+	int *perm = malloc(n*sizeof(int));
+	if(narrow_band(&shape, n)){
+		int kl = shape.lower, ku = shape.upper;
+		long double *ab = band_copy(matrix, n, kl, ku);
+		det = band_factor(ab, perm, n, kl, ku);
+		for(int k = 0; k < n; k++){
+			det *= ab[(2*kl+ku+1)*k + kl+ku];
+		}
+		free(ab);
+	}else{
+		long double *lu = malloc((size_t)n*n*sizeof(long double));
+		memcpy(lu, matrix, (size_t)n*n*sizeof(long double));
+		det = lu_factor(lu, perm, n);
+		for(int k = 0; k < n; k++){
+			det *= lu[n*k+k];
+		}
+		free(lu);
+	}
+	free(perm);
+	return det;
+}
+
+/*
+Function does an LU factorisation with complete pivoting in place, P A Q = L U,
+choosing the biggest element left as each pivot so that the diagonal of U
+shows the rank of A. rowp[k] and colp[k] are the row and column swapped with
+k at step k. Returns the sign of the two permutations together.
+*/
+static int lu_complete(long double *lu, int *rowp, int *colp, int n){
+	int sign = 1;
+	for(int k = 0; k < n; k++){
+		int p = k, q = k;
+		long double best = 0.0;
+		for(int i = k; i < n; i++){
+			for(int j = k; j < n; j++){
+				if(fabsl(lu[n*i+j]) > best){
+					best = fabsl(lu[n*i+j]);
+					p = i;
+					q = j;
+				}
+			}
+		}
+		rowp[k] = p;
+		colp[k] = q;
+		if(p != k){
+			for(int j = 0; j < n; j++){
+				long double t = lu[n*k+j];
+				lu[n*k+j] = lu[n*p+j];
+				lu[n*p+j] = t;
+			}
+			sign = -sign;
+		}
+		if(q != k){
+			for(int i = 0; i < n; i++){
+				long double t = lu[n*i+k];
+				lu[n*i+k] = lu[n*i+q];
+				lu[n*i+q] = t;
+			}
+			sign = -sign;
+		}
+		/*everything left is 0*/
+		if(best == 0.0){
+			break;
+		}
+		for(int i = k+1; i < n; i++){
+			long double f = lu[n*i+k]/lu[n*k+k];
+			lu[n*i+k] = f;
+			if(f == 0.0){
+				continue;
+			}
+			for(int j = k+1; j < n; j++){
+				lu[n*i+j] -= f*lu[n*k+j];
+			}
+		}
+	}
+	return sign;
+}
+
+/*
+Find the adjoint (adjugate) of input matrix and return passed array.
+One factorisation P A Q = L U with complete pivoting gives it in O(n^3) time,
+as adj(A) = sign Q adj(U) L^-1 P. If A is non-singular that is det(A) A^-1.
+If A has rank n-1 then the last pivot is 0 and adj(U) only has a last column,
+det(U11) x with U x = 0 and x_n = 1, so adj(A) = sign det(U11) (Q x)(z^T P)
+where z^T is the last row of L^-1. With a lower rank every minor is 0.
+*/
+void adjoint(long double *matrix, long double *adjoint_mat, unsigned int rank){
+	int n = rank;
+	if(n == 1){
+		adjoint_mat[0] = 1.0;
+		return;
+	}
+
+	/*one workspace for the factors, two vectors and the permutations*/
+	size_t nn = (size_t)n*n;
+	long double *lu = malloc((nn + 2*n)*sizeof(long double) + 4*n*sizeof(int));
+	long double *x = lu + nn, *z = x + n;
+	int *rowp = (int *)(z + n), *colp = rowp + n, *rows = colp + n, *cols = rows + n;
+
+	memcpy(lu, matrix, nn*sizeof(long double));
+	long double det = lu_complete(lu, rowp, colp, n);
+
+	/*rows[k] and cols[k] are where row and column k of L U came from in A*/
+	for(int k = 0; k < n; k++){
+		rows[k] = cols[k] = k;
+	}
+	for(int k = 0; k < n; k++){
+		int t = rows[k]; rows[k] = rows[rowp[k]]; rows[rowp[k]] = t;
+		t = cols[k]; cols[k] = cols[colp[k]]; cols[colp[k]] = t;
+	}
+
+	/*pivots this small compared to the first are taken as 0*/
+	long double tol = n*LDBL_EPSILON*fabsl(lu[0]);
+	int matrix_rank = 0;
+	while(matrix_rank < n && fabsl(lu[(n+1)*matrix_rank]) > tol){
+		matrix_rank++;
+	}
+
+	if(matrix_rank == n){
+		/*Y = U^-1 L^-1 P, starting from P and solving in place*/
+		for(int k = 0; k < n; k++){
+			det *= lu[n*k+k];
+		}
+		for(size_t k = 0; k < nn; k++){
+			adjoint_mat[k] = 0.0;
+		}
+		for(int k = 0; k < n; k++){
+			adjoint_mat[n*k+rows[k]] = 1.0;
+		}
+		for(int k = 0; k < n; k++){
+			for(int i = k+1; i < n; i++){
+				long double f = lu[n*i+k];
+				for(int j = 0; j < n; j++){
+					adjoint_mat[n*i+j] -= f*adjoint_mat[n*k+j];
+				}
+			}
+		}
+		for(int k = n-1; k >= 0; k--){
+			long double rcp = 1.0/lu[n*k+k];
+			for(int j = 0; j < n; j++){
+				adjoint_mat[n*k+j] *= rcp;
+			}
+			for(int i = 0; i < k; i++){
+				long double f = lu[n*i+k];
+				for(int j = 0; j < n; j++){
+					adjoint_mat[n*i+j] -= f*adjoint_mat[n*k+j];
+				}
+			}
+		}
+		/*adj(A) = det(A) Q Y, the factors aren't needed any more so Y is moved there*/
+		memcpy(lu, adjoint_mat, nn*sizeof(long double));
+		for(int k = 0; k < n; k++){
+			for(int j = 0; j < n; j++){
+				adjoint_mat[n*cols[k]+j] = det*lu[n*k+j];
+			}
+		}
+	}else if(matrix_rank == n-1){
+		/*x solves U11 y = -u12 with x = [y; 1]*/
+		for(int k = 0; k < n-1; k++){
+			det *= lu[n*k+k];
+		}
+		x[n-1] = 1.0;
+		for(int i = n-2; i >= 0; i--){
+			long double sum = lu[n*i+n-1];
+			for(int k = i+1; k < n-1; k++){
+				sum += lu[n*i+k]*x[k];
+			}
+			x[i] = -sum/lu[n*i+i];
+		}
+		/*z solves L^T z = e_n*/
+		z[n-1] = 1.0;
+		for(int i = n-2; i >= 0; i--){
+			long double sum = 0.0;
+			for(int k = i+1; k < n; k++){
+				sum += lu[n*k+i]*z[k];
+			}
+			z[i] = -sum;
+		}
+		for(int i = 0; i < n; i++){
+			for(int j = 0; j < n; j++){
+				adjoint_mat[n*cols[i]+rows[j]] = det*x[i]*z[j];
+			}
+		}
+	}else{
+		for(size_t k = 0; k < nn; k++){
+			adjoint_mat[k] = 0.0;
+		}
+	}
+	free(lu);
+}
+
+/*
+Function takes in matrix and finds its inverse, using the cheapest method its
+structure allows. hint may be NULL, when the structure is found from the matrix.
+Returns the determinant, which falls out of the factorisation.
+*/
+long double inverse(long double *matrix, long double *inverse_mat, unsigned int rank, struct shape *hint){
+	int n = rank;
+	struct shape shape;
+	long double det = 1.0;
+	find_shape(matrix, n, hint, &shape);
+
+	if(shape.kind == STRUCT_DIAGONAL || shape.kind == STRUCT_UPPER || shape.kind == STRUCT_LOWER){
+		triangular_inverse(matrix, inverse_mat, n, shape.kind != STRUCT_LOWER);
+		for(int k = 0; k < n; k++){
+			det *= matrix[n*k+k];
+		}
+		return det;
+	}
+	/*A^-1 = L^-T L^-1, which is symmetric so only half of it is worked out*/
+	if(shape.kind == STRUCT_SYMMETRIC || shape.kind == STRUCT_SPD){
+		long double *l = malloc(2*PACKED(n, 0)*sizeof(long double));
+		long double *x = l + PACKED(n, 0);
+		int positive = cholesky(matrix, l, n);
+		if(positive){
+			for(int k = 0; k < n; k++){
+				det *= l[PACKED(k, k)]*l[PACKED(k, k)];
+			}
+			packed_lower_inverse(l, x, n);
+			for(int i = 0; i < n; i++){
+				for(int j = 0; j <= i; j++){
+					long double sum = 0.0;
+					for(int k = i; k < n; k++){
+						sum += x[PACKED(k, i)]*x[PACKED(k, j)];
+					}
+					inverse_mat[n*i+j] = inverse_mat[n*j+i] = sum;
+				}
+			}
+		}
+		free(l);
+		if(positive){
+			return det;
+		}
+	}
+
+	/*otherwise solve A X = I with an LU factorisation*/
+	int *perm = malloc(n*sizeof(int));
+	for(int i = 0; i < n; i++){
+		for(int j = 0; j < n; j++){
+			inverse_mat[n*i+j] = (i == j) ? 1.0 : 0.0;
+		}
+	}
+	if(narrow_band(&shape, n)){
+		int kl = shape.lower, ku = shape.upper;
+		long double *ab = band_copy(matrix, n, kl, ku);
+		det = band_factor(ab, perm, n, kl, ku);
+		for(int k = 0; k < n; k++){
+			det *= ab[(2*kl+ku+1)*k + kl+ku];
+		}
+		band_solve(ab, perm, n, kl, ku, inverse_mat, n);
+		free(ab);
+	}else{
+		long double *lu = malloc((size_t)n*n*sizeof(long double));
+		memcpy(lu, matrix, (size_t)n*n*sizeof(long double));
+		det = lu_factor(lu, perm, n);
+		for(int k = 0; k < n; k++){
+			det *= lu[n*k+k];
+		}
+		lu_solve(lu, perm, n, inverse_mat, n);
+		free(lu);
+	}
+	free(perm);
+	return det;
+}
+
+/*Function solves A X = B with a long double LU factorisation, B is n x nrhs*/
+void solve(long double *a, long double *b, long double *x, int n, int nrhs){
+	long double *lu = malloc((size_t)n*n*sizeof(long double));
+	int *perm = malloc(n*sizeof(int));
+	memcpy(lu, a, (size_t)n*n*sizeof(long double));
+	memcpy(x, b, (size_t)n*nrhs*sizeof(long double));
+	lu_factor(lu, perm, n);
+	lu_solve(lu, perm, n, x, nrhs);
+	free(lu);
+	free(perm);
+}
+
+/*
+Low precision copies of lu_factor and lu_solve for mixed precision work. The
+inner loops run along rows in float or double so the compiler can vectorise
+them, which it can't do for long double.
+*/
+#define LOW_PRECISION_LU(T, SUFFIX) \
+	static void lu_factor_##SUFFIX(T *lu, int *perm, int n){ \
+		for(int k = 0; k < n; k++){ \
+			int p = k; \
+			T best = fabs(lu[(size_t)n*k+k]); \
+			for(int i = k+1; i < n; i++){ \
+				if(fabs(lu[(size_t)n*i+k]) > best){ \
+					best = fabs(lu[(size_t)n*i+k]); \
+					p = i; \
+				} \
+			} \
+			perm[k] = p; \
+			if(p != k){ \
+				for(int j = 0; j < n; j++){ \
+					T t = lu[(size_t)n*k+j]; \
+					lu[(size_t)n*k+j] = lu[(size_t)n*p+j]; \
+					lu[(size_t)n*p+j] = t; \
+				} \
+			} \
+			T piv = lu[(size_t)n*k+k]; \
+			if(piv == 0){ \
+				continue; \
+			} \
+			const T *row_k = lu + (size_t)n*k; \
+			for(int i = k+1; i < n; i++){ \
+				T *row_i = lu + (size_t)n*i; \
+				T f = row_i[k]/piv; \
+				row_i[k] = f; \
+				for(int j = k+1; j < n; j++){ \
+					row_i[j] -= f*row_k[j]; \
+				} \
+			} \
+		} \
+	} \
+	static void lu_solve_##SUFFIX(T *lu, int *perm, int n, T *b, int nrhs){ \
+		for(int k = 0; k < n; k++){ \
+			if(perm[k] != k){ \
+				for(int j = 0; j < nrhs; j++){ \
+					T t = b[(size_t)nrhs*k+j]; \
+					b[(size_t)nrhs*k+j] = b[(size_t)nrhs*perm[k]+j]; \
+					b[(size_t)nrhs*perm[k]+j] = t; \
+				} \
+			} \
+		} \
+		for(int k = 0; k < n; k++){ \
+			const T *b_k = b + (size_t)nrhs*k; \
+			for(int i = k+1; i < n; i++){ \
+				T f = lu[(size_t)n*i+k]; \
+				T *b_i = b + (size_t)nrhs*i; \
+				for(int j = 0; j < nrhs; j++){ \
+					b_i[j] -= f*b_k[j]; \
+				} \
+			} \
+		} \
+		for(int k = n-1; k >= 0; k--){ \
+			T *b_k = b + (size_t)nrhs*k; \
+			T rcp = 1/lu[(size_t)n*k+k]; \
+			for(int j = 0; j < nrhs; j++){ \
+				b_k[j] *= rcp; \
+			} \
+			for(int i = 0; i < k; i++){ \
+				T f = lu[(size_t)n*i+k]; \
+				T *b_i = b + (size_t)nrhs*i; \
+				for(int j = 0; j < nrhs; j++){ \
+					b_i[j] -= f*b_k[j]; \
+				} \
+			} \
+		} \
+	}
+
+LOW_PRECISION_LU(float, f32)
+LOW_PRECISION_LU(double, f64)
+
+/*Largest row sum of absolute values, the infinity norm*/
+static long double norm_inf(long double *matrix, int rows, int cols){
+	long double biggest = 0.0;
+	for(int i = 0; i < rows; i++){
+		long double sum = 0.0;
+		for(int j = 0; j < cols; j++){
+			sum += fabsl(matrix[(size_t)cols*i+j]);
+		}
+		if(sum > biggest){
+			biggest = sum;
+		}
+	}
+	return biggest;
+}
+
+/*
+Function works out R = B - A X in double-double arithmetic, where A and X are
+each given as a high and a low double whose sum is the long double value.
+Each product is made exact with fma and summed with error free additions, so
+the loops vectorise and the result is more accurate than long double. acc has
+room for 2 nrhs doubles. fp-contract is turned off as fused operations in the
+error free additions would break them.
+*/
+__attribute__((optimize("fp-contract=off")))
+static void residual_dd(const double *a_hi, const double *a_lo, const double *x_hi, const double *x_lo,
+		const long double *b, long double *r, int n, int nrhs, double *acc){
+	double *sum = acc, *comp = acc + nrhs;
+	for(int i = 0; i < n; i++){
+		for(int j = 0; j < nrhs; j++){
+			sum[j] = 0.0;
+			comp[j] = 0.0;
+		}
+		for(int k = 0; k < n; k++){
+			double ah = a_hi[(size_t)n*i+k], al = a_lo[(size_t)n*i+k];
+			const double *xh = x_hi + (size_t)nrhs*k, *xl = x_lo + (size_t)nrhs*k;
+			for(int j = 0; j < nrhs; j++){
+				double p = ah*xh[j];
+				double e = fma(ah, xh[j], -p) + (ah*xl[j] + al*xh[j]);
+				double t = sum[j] + p;
+				double z = t - sum[j];
+				comp[j] += ((sum[j] - (t - z)) + (p - z)) + e;
+				sum[j] = t;
+			}
+		}
+		for(int j = 0; j < nrhs; j++){
+			r[(size_t)nrhs*i+j] = b[(size_t)nrhs*i+j] - ((long double)sum[j] + comp[j]);
+		}
+	}
+}
+
+/*
+Function solves A X = B (B and X are n x nrhs) by factorising A in float
+(bits = 32) or double (bits = 64) and refining X with residuals R = B - A X
+worked out in double-double arithmetic. It stops when the backward error
+||R|| / (||A|| ||X|| + ||B||) is down to what a long double LU gives, and gives
+up if an iteration fails to halve it. Returns the number of refinement steps,
+or -1 if it gave up, when X should be found another way.
+*/
+int mixed_solve(long double *a, long double *b, long double *x, int n, int nrhs, int bits){
+	size_t nn = (size_t)n*n, nb = (size_t)n*nrhs;
+	size_t low_size = (bits == 32) ? sizeof(float) : sizeof(double);
+	void *lu = malloc(nn*low_size);
+	void *rhs = malloc(nb*low_size);
+	long double *residual = malloc(nb*sizeof(long double));
+	int *perm = malloc(n*sizeof(int));
+	long double target = sqrtl((long double)n)*LDBL_EPSILON;
+	long double norm_a = norm_inf(a, n, n), norm_b = norm_inf(b, n, nrhs);
+	long double last = INFINITY;
+	int max_steps = (bits == 32) ? 30 : 10;
+	int steps = -1;
+	double *a_hi = malloc(2*(nn + nb + nrhs)*sizeof(double));
+	double *a_lo = a_hi + nn, *x_hi = a_lo + nn, *x_lo = x_hi + nb, *acc = x_lo + nb;
+
+	/*a long double is held exactly by the sum of two doubles*/
+	for(size_t k = 0; k < nn; k++){
+		a_hi[k] = a[k];
+		a_lo[k] = a[k] - a_hi[k];
+	}
+
+	/*factorise once in low precision, then every solve with it is cheap*/
+	for(size_t k = 0; k < nn; k++){
+		if(bits == 32) ((float *)lu)[k] = a[k];
+		else ((double *)lu)[k] = a[k];
+	}
+	if(bits == 32) lu_factor_f32(lu, perm, n);
+	else lu_factor_f64(lu, perm, n);
+
+	memcpy(residual, b, nb*sizeof(long double));
+	for(size_t k = 0; k < nb; k++){
+		x[k] = 0.0;
+	}
+	for(int step = 0; step <= max_steps; step++){
+		/*correction D from A D = R, then X = X + D*/
+		for(size_t k = 0; k < nb; k++){
+			if(bits == 32) ((float *)rhs)[k] = residual[k];
+			else ((double *)rhs)[k] = residual[k];
+		}
+		if(bits == 32) lu_solve_f32(lu, perm, n, rhs, nrhs);
+		else lu_solve_f64(lu, perm, n, rhs, nrhs);
+		for(size_t k = 0; k < nb; k++){
+			x[k] += (bits == 32) ? ((float *)rhs)[k] : ((double *)rhs)[k];
+		}
+
+		/*R = B - A X, with X split into a high and low double like A*/
+		for(size_t k = 0; k < nb; k++){
+			x_hi[k] = x[k];
+			x_lo[k] = x[k] - x_hi[k];
+		}
+		residual_dd(a_hi, a_lo, x_hi, x_lo, b, residual, n, nrhs, acc);
+		long double error = norm_inf(residual, n, nrhs)/(norm_a*norm_inf(x, n, nrhs) + norm_b);
+		if(error <= target){
+			steps = step;
+			break;
+		}
+		if(!(error < 0.5*last)){
+			break;
+		}
+		last = error;
+	}
+
+	if(steps < 0){
+		printf("Mixed precision refinement did not converge, using long double\n");
+	}else{
+		printf("Mixed precision refinement took %d steps\n", steps);
+	}
+	free(lu);
+	free(rhs);
+	free(residual);
+	free(perm);
+	free(a_hi);
+	return steps;
+}
+
+/*Function to print the comment lines that start every output file*/
+void print_header(FILE *fp, int argc, char **argv){
+	fprintf(fp, "# ");
+	for(int i = 0; i < argc; i++){
+		fprintf(fp, "%s ", argv[i]);
+	}
+	fprintf(fp, "\n");
+	fprintf(fp, "# Version = %s, Revision date = %s\n", VERSION, REV_DATE);
+}
+
+/*
+Function to print the 'matrix R C' line, the rows and the 'end' line, with all
+the digits of a long double if exact is set. If offsets isn't NULL the position
+of every index_every'th row is stored in it.
+*/
+static void print_values(FILE *fp, long double *matrix, int *size, int exact, long *offsets){
+	fprintf(fp, "matrix %d %d\n", size[0], size[1]);
+	for(int j = 0; j < size[0]; j++){
+		if(offsets != NULL && j % index_every == 0){
+			offsets[j / index_every] = ftell(fp);
+		}
+		for(int k = 0; k < size[1]; k++){
+			if(exact){
+				fprintf(fp, "%.21Lg	", matrix[size[1]*j+k]);
+			}else{
+				fprintf(fp, "%LF	", matrix[size[1]*j+k]);
+			}
+		}
+		fprintf(fp, "\n");
+	}
+	fprintf(fp, "end\n");
+}
+
+/*
+Function to print one 'matrix R C ... end' block, with all the digits if exact
+is set, as inverses are so that they match the ones print_exact_file writes
+*/
+void print_block(FILE *fp, long double *matrix, int *size, int exact){
+	print_values(fp, matrix, size, exact, NULL);
+}
+
+/*
+Function to print a whole output file, with an index sidecar if --index was
+given, or packed if --compress was. det, if it isn't NAN, is noted as the
+determinant of the matrix inverted, in text files only.
+*/
+static void print_whole_file(long double *matrix, int *size, int exact, long double det, char *output_file, int argc, char **argv){
+	FILE *fp;
+	if(compress_flg){
+		write_packed(output_file, matrix, size);
+		return;
+	}
+	fp = fopen(output_file,"w");
+	if(fp == NULL){
+		printf("Could not open %s for writing\n", output_file);
+		return;
+	}
+	long *offsets = NULL;
+	if(index_every > 0){
+		offsets = malloc(((size[0] + index_every-1)/index_every)*sizeof(long));
+	}
+	print_header(fp, argc, argv);
+	if(!isnan(det)){
+		fprintf(fp, "# Determinant = %.21Lg\n", det);
+	}
+	print_values(fp, matrix, size, exact, offsets);
+	fclose(fp);
+	if(offsets != NULL){
+		write_index(output_file, size, offsets);
+		free(offsets);
+	}
+}
+
+/*Function to print a file of the result matrix in the same format as imput*/
+void print_file(long double *matrix, int *size, char *output_file, int argc, char **argv){
+	print_whole_file(matrix, size, 0, NAN, output_file, argc, argv);
+}
+
+/*
+Function prints a matrix like print_file but with all the digits of a long
+double, so that inverses can be used by --update without losing accuracy.
+det, if it isn't NAN, is noted as the determinant of the matrix inverted.
+*/
+void print_exact_file(long double *matrix, int *size, long double det, char *output_file, int argc, char **argv){
+	print_whole_file(matrix, size, 1, det, output_file, argc, argv);
+}
+
+/*
+Function writes filename.idx next to a file just written with the offsets
+of every index_every'th row. The size and time of the file are kept in it
+so that a sidecar left over from an older file is not trusted.
+*/
+void write_index(char *filename, int *size, long *offsets){
+	char idx_name[FILENAME_MAX];
+	struct stat st;
+	struct index_header h;
+	snprintf(idx_name, sizeof(idx_name), "%s.idx", filename);
+	if(stat(filename, &st) != 0){
+		return;
+	}
+	memset(&h, 0, sizeof(h));
+	strcpy(h.magic, INDEX_MAGIC);
+	h.every = index_every;
+	h.rows = size[0];
+	h.cols = size[1];
+	h.data_size = st.st_size;
+	h.data_sec = st.st_mtime;
+	h.data_nsec = MTIME_NSEC(st);
+	h.count = (size[0] + index_every-1)/index_every;
+	FILE *fp = fopen(idx_name, "wb");
+	if(fp == NULL){
+		printf("Could not open %s for writing\n", idx_name);
+		return;
+	}
+	int ok = (fwrite(&h, sizeof(h), 1, fp) == 1);
+	for(uint64_t k = 0; ok && k < h.count; k++){
+		uint64_t offset = offsets[k];
+		ok = (fwrite(&offset, sizeof(offset), 1, fp) == 1);
+	}
+	if(fclose(fp) != 0 || !ok){
+		printf("Could not write %s\n", idx_name);
+		remove(idx_name);
+	}
+}
+
+/*
+Function finds where to start reading row 'row' of filename from its .idx
+sidecar. Returns the offset of the nearest indexed row at or above it and
+stores that row number in 'found', or returns -1 if there is no sidecar or
+it doesn't match the file.
+*/
+static long find_index(char *filename, int *size, int row, int *found){
+	char idx_name[FILENAME_MAX];
+	struct stat st;
+	struct index_header h;
+	uint64_t offset;
+	long result = -1;
+	snprintf(idx_name, sizeof(idx_name), "%s.idx", filename);
+	if(stat(filename, &st) != 0){
+		return -1;
+	}
+	FILE *fp = fopen(idx_name, "rb");
+	if(fp == NULL){
+		return -1;
+	}
+	if(fread(&h, sizeof(h), 1, fp) == 1 && memcmp(h.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0
+	&& h.every > 0 && h.rows == (uint64_t)size[0] && h.cols == (uint64_t)size[1]
+	&& h.data_size == (uint64_t)st.st_size && h.data_sec == st.st_mtime && h.data_nsec == MTIME_NSEC(st)){
+		uint64_t k = row / h.every;
+		if(k < h.count && fseek(fp, sizeof(h) + k*sizeof(offset), SEEK_SET) == 0
+		&& fread(&offset, sizeof(offset), 1, fp) == 1 && offset < h.data_size){
+			*found = k * h.every;
+			result = offset;
+		}
+	}
+	fclose(fp);
+	return result;
+}
+
+/*Function skips over count values, or to the end of the line if count < 0*/
+static int skip_values(FILE *fp, long count){
+	int ch = 0;
+	if(count < 0){
+		while((ch = getc(fp)) != EOF && ch != '\n');
+		return ch != EOF;
+	}
+	for(long k = 0; k < count; k++){
+		while((ch = getc(fp)) != EOF && isspace(ch));
+		while(ch != EOF && !isspace(ch)){
+			ch = getc(fp);
+		}
+		if(ch == EOF){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+Function loads rows range[0] to range[1]-1 and columns range[2] to range[3]-1
+of the size[0] x size[1] matrix whose header has just been read from the
+input. With a matching .idx sidecar it seeks to the nearest indexed row and
+then only has to skip whole lines, as files with an index have one row per
+line, otherwise it skips every value before the part.
+Returns 0 if the part couldn't be read.
+*/
+int get_part(struct input *in, int *size, int *range, long double *matrix){
+	int rows = range[1] - range[0], cols = range[3] - range[2];
+	FILE *fp = in->fp;
+	struct stat st;
+	int row = 0;
+	long offset = -1;
+	if(in->packed){
+		return unpack_rows(in, range, matrix);
+	}
+	/*only a file on disk can have an index and be seeked in*/
+	if(fp != stdin && fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode)){
+		offset = find_index(in->name, size, range[0], &row);
+	}
+	int by_line = (offset >= 0);
+	int ok = 1;
+	if(by_line){
+		printf("Using index %s.idx\n", in->name);
+		ok = (fseek(fp, offset, SEEK_SET) == 0);
+		for(; ok && row < range[0]; row++){
+			ok = skip_values(fp, -1);
+		}
+	}else{
+		ok = skip_values(fp, (long)range[0]*size[1]);
+	}
+	for(int i = 0; ok && i < rows; i++){
+		ok = skip_values(fp, range[2]);
+		for(int j = 0; ok && j < cols; j++){
+			ok = (fscanf(fp, "%Lf", &matrix[cols*i+j]) == 1);
+		}
+		if(ok){
+			ok = skip_values(fp, by_line ? -1 : size[1] - range[3]);
+		}
+	}
+	if(!ok){
+		printf("Could not read matrix from %s\n", in->name);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+======================================================================================================
+Batched kernels for streams of small matrices.
+
+A batch holds LANES matrices of the same size n in structure-of-arrays form,
+element ij of matrix l is at a[(n*i+j)*LANES + l], so each loop over l works on
+the same element of every matrix in the batch and is turned into SIMD
+instructions by the compiler. The kernels are written once for any n and then
+stamped out for each size from SMALL_MIN to SMALL_MAX so n is a constant in
+every copy and all the loops over rows and columns can be unrolled.
+The batch kernels work in double precision.
+======================================================================================================
+*/
+
+#define LANES 8 /*matrices worked on at once, a multiple of the SIMD width*/
+#define SMALL_MIN 2
+#define SMALL_MAX 16
+#define SOA(i, j, n) (((n)*(i)+(j))*LANES)
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+/*Each matrix chooses its own pivot, so pivot search and row swaps are done per lane*/
+ALWAYS_INLINE int pivot_lane(double *a, double *x, int k, int l, const int n){
+	int p = k;
+	double best = fabs(a[SOA(k,k,n)+l]);
+	for(int i = k+1; i < n; i++){
+		double v = fabs(a[SOA(i,k,n)+l]);
+		if(v > best){
+			best = v;
+			p = i;
+		}
+	}
+	if(p == k){
+		return 0;
+	}
+	for(int j = k; j < n; j++){
+		double t = a[SOA(k,j,n)+l];
+		a[SOA(k,j,n)+l] = a[SOA(p,j,n)+l];
+		a[SOA(p,j,n)+l] = t;
+	}
+	if(x != NULL){
+		for(int j = 0; j < n; j++){
+			double t = x[SOA(k,j,n)+l];
+			x[SOA(k,j,n)+l] = x[SOA(p,j,n)+l];
+			x[SOA(p,j,n)+l] = t;
+		}
+	}
+	return 1;
+}
+
+/*Determinants of a batch by Gaussian elimination with partial pivoting, overwrites a*/
+ALWAYS_INLINE void det_soa(double *a, double *det, const int n){
+	double sign[LANES];
+	for(int l = 0; l < LANES; l++){
+		sign[l] = 1.0;
+	}
+	for(int k = 0; k < n; k++){
+		for(int l = 0; l < LANES; l++){
+			if(pivot_lane(a, NULL, k, l, n)){
+				sign[l] = -sign[l];
+			}
+		}
+		/*a zero pivot means the matrix is singular, its determinant ends up 0*/
+		double rcp[LANES];
+		for(int l = 0; l < LANES; l++){
+			double piv = a[SOA(k,k,n)+l];
+			rcp[l] = (piv != 0.0) ? 1.0/piv : 0.0;
+		}
+		for(int i = k+1; i < n; i++){
+			double f[LANES];
+			for(int l = 0; l < LANES; l++){
+				f[l] = a[SOA(i,k,n)+l]*rcp[l];
+			}
+			for(int j = k+1; j < n; j++){
+				for(int l = 0; l < LANES; l++){
+					a[SOA(i,j,n)+l] -= f[l]*a[SOA(k,j,n)+l];
+				}
+			}
+		}
+	}
+	for(int l = 0; l < LANES; l++){
+		det[l] = sign[l];
+	}
+	for(int k = 0; k < n; k++){
+		for(int l = 0; l < LANES; l++){
+			det[l] *= a[SOA(k,k,n)+l];
+		}
+	}
+}
+
+/*Inverses and determinants of a batch by Gauss-Jordan elimination, overwrites a*/
+ALWAYS_INLINE void inv_soa(double *a, double *x, double *det, const int n){
+	for(int i = 0; i < n; i++){
+		for(int j = 0; j < n; j++){
+			for(int l = 0; l < LANES; l++){
+				x[SOA(i,j,n)+l] = (i == j) ? 1.0 : 0.0;
+			}
+		}
+	}
+	for(int l = 0; l < LANES; l++){
+		det[l] = 1.0;
+	}
+	for(int k = 0; k < n; k++){
+		for(int l = 0; l < LANES; l++){
+			if(pivot_lane(a, x, k, l, n)){
+				det[l] = -det[l];
+			}
+		}
+		/*scale the pivot row so the pivot becomes 1*/
+		double rcp[LANES];
+		for(int l = 0; l < LANES; l++){
+			double piv = a[SOA(k,k,n)+l];
+			det[l] *= piv;
+			rcp[l] = (piv != 0.0) ? 1.0/piv : 0.0;
+		}
+		for(int j = k+1; j < n; j++){
+			for(int l = 0; l < LANES; l++){
+				a[SOA(k,j,n)+l] *= rcp[l];
+			}
+		}
+		for(int j = 0; j < n; j++){
+			for(int l = 0; l < LANES; l++){
+				x[SOA(k,j,n)+l] *= rcp[l];
+			}
+		}
+		/*clear column k from every other row*/
+		for(int i = 0; i < n; i++){
+			if(i == k){
+				continue;
+			}
+			double f[LANES];
+			for(int l = 0; l < LANES; l++){
+				f[l] = a[SOA(i,k,n)+l];
+			}
+			for(int j = k+1; j < n; j++){
+				for(int l = 0; l < LANES; l++){
+					a[SOA(i,j,n)+l] -= f[l]*a[SOA(k,j,n)+l];
+				}
+			}
+			for(int j = 0; j < n; j++){
+				for(int l = 0; l < LANES; l++){
+					x[SOA(i,j,n)+l] -= f[l]*x[SOA(k,j,n)+l];
+				}
+			}
+		}
+	}
+}
+
+/*Products c = a*b of a batch of pairs*/
+ALWAYS_INLINE void mul_soa(const double *a, const double *b, double *c, const int n){
+	for(int i = 0; i < n; i++){
+		for(int j = 0; j < n; j++){
+			double sum[LANES] = {0.0};
+			for(int k = 0; k < n; k++){
+				for(int l = 0; l < LANES; l++){
+					sum[l] += a[SOA(i,k,n)+l]*b[SOA(k,j,n)+l];
+				}
+			}
+			for(int l = 0; l < LANES; l++){
+				c[SOA(i,j,n)+l] = sum[l];
+			}
+		}
+	}
+}
+
+/*Stamp out a copy of each kernel for one size*/
+#define SMALL_KERNELS(N) \
+	static void det_batch_##N(double *a, double *b, double *x, double *det){ \
+		(void)b; (void)x; det_soa(a, det, N); \
+	} \
+	static void inv_batch_##N(double *a, double *b, double *x, double *det){ \
+		(void)b; inv_soa(a, x, det, N); \
+	} \
+	static void mul_batch_##N(double *a, double *b, double *x, double *det){ \
+		(void)det; mul_soa(a, b, x, N); \
+	}
+
+SMALL_KERNELS(2)  SMALL_KERNELS(3)  SMALL_KERNELS(4)  SMALL_KERNELS(5)
+SMALL_KERNELS(6)  SMALL_KERNELS(7)  SMALL_KERNELS(8)  SMALL_KERNELS(9)
+SMALL_KERNELS(10) SMALL_KERNELS(11) SMALL_KERNELS(12) SMALL_KERNELS(13)
+SMALL_KERNELS(14) SMALL_KERNELS(15) SMALL_KERNELS(16)
+
+typedef void (*batch_kernel)(double *a, double *b, double *x, double *det);
+
+#define SMALL_TABLE(K) { 0, 0, K##_2, K##_3, K##_4, K##_5, K##_6, K##_7, K##_8, \
+	K##_9, K##_10, K##_11, K##_12, K##_13, K##_14, K##_15, K##_16 }
+
+static const batch_kernel det_batch[SMALL_MAX+1] = SMALL_TABLE(det_batch);
+static const batch_kernel inv_batch[SMALL_MAX+1] = SMALL_TABLE(inv_batch);
+static const batch_kernel mul_batch[SMALL_MAX+1] = SMALL_TABLE(mul_batch);
+
+/*A batch waiting to be worked on, all its matrices are n x n*/
+struct batch {
+	int n;
+	int filled;
+	double a[SMALL_MAX*SMALL_MAX*LANES] __attribute__((aligned(64)));
+	double b[SMALL_MAX*SMALL_MAX*LANES] __attribute__((aligned(64)));
+	double x[SMALL_MAX*SMALL_MAX*LANES] __attribute__((aligned(64)));
+	double det[LANES];
+	long singular;/*count of singular matrices met by -i*/
+};
+
+/*Function to put one matrix into the next free lane of a batch*/
+static void batch_put(double *soa, long double *matrix, int lane, int n){
+	for(int i = 0; i < n; i++){
+		for(int j = 0; j < n; j++){
+			soa[SOA(i,j,n)+lane] = matrix[n*i+j];
+		}
+	}
+}
+
+/*Function to run the kernel for the filled lanes of a batch and print the results*/
+static void batch_flush(struct batch *bt, char op, FILE *out){
+	int n = bt->n;
+	long double result[SMALL_MAX*SMALL_MAX];
+	int size[2] = {n, n};
+	if(bt->filled == 0){
+		return;
+	}
+	/*unused lanes get the identity so they can't upset the kernels*/
+	for(int l = bt->filled; l < LANES; l++){
+		for(int i = 0; i < n; i++){
+			for(int j = 0; j < n; j++){
+				bt->a[SOA(i,j,n)+l] = (i == j) ? 1.0 : 0.0;
+				bt->b[SOA(i,j,n)+l] = (i == j) ? 1.0 : 0.0;
+			}
+		}
+	}
+	if(op == 'd'){
+		det_batch[n](bt->a, bt->b, bt->x, bt->det);
+		for(int l = 0; l < bt->filled; l++){
+			printf("%LF\n", (long double)bt->det[l]);
+		}
+	}else{
+		if(op == 'i'){
+			inv_batch[n](bt->a, bt->b, bt->x, bt->det);
+		}else{
+			mul_batch[n](bt->a, bt->b, bt->x, bt->det);
+		}
+		for(int l = 0; l < bt->filled; l++){
+			int singular = (op == 'i' && bt->det[l] == 0.0);
+			for(int i = 0; i < n; i++){
+				for(int j = 0; j < n; j++){
+					result[n*i+j] = singular ? NAN : bt->x[SOA(i,j,n)+l];
+				}
+			}
+			bt->singular += singular;
+			print_block(out, result, size, op == 'i');
+		}
+	}
+	bt->filled = 0;
+}
+
+/*
+Function works through a file of many matrices (two files for -m). Runs of
+square blocks of a size with a batch kernel are gathered into batches, any
+other block is worked on by itself with the general functions, in order.
+For -m first_product, if it isn't NULL, is the product of the first pair,
+already found by main while the first block was read, and is printed as it
+is. first_hint is the structure named in the header of the first block, and
+each later block uses the one named in its own header.
+Returns the number of blocks done.
+*/
+int run_stream(char op, struct input *in1, struct input *in2, int *first1, long double *first_matrix1, int *first2, long double *first_matrix2, long double *first_product, struct shape *first_hint, char *output_file, int argc, char **argv){
+	int size1[2] = {first1[0], first1[1]}, size2[2] = {first2[0], first2[1]};
+	struct shape hint = *first_hint;
+	long done = 0;
+	size_t space1 = (size_t)size1[0]*size1[1], space2 = (size_t)size2[0]*size2[1], space_r = 0;
+	long double *matrix1 = malloc(space1*sizeof(long double));
+	long double *matrix2 = (op == 'm') ? malloc(space2*sizeof(long double)) : NULL;
+	long double *result = NULL;
+	struct batch *bt = calloc(1, sizeof(struct batch));
+	FILE *out = NULL;
+
+	/*the first blocks have already been read by main*/
+	memcpy(matrix1, first_matrix1, space1*sizeof(long double));
+	if(op == 'm'){
+		memcpy(matrix2, first_matrix2, space2*sizeof(long double));
+	}
+	if(op != 'd'){
+		if((out = fopen(output_file, "w")) == NULL){
+			printf("Could not open %s for writing\n", output_file);
+			goto finish;
+		}
+		print_header(out, argc, argv);
+	}
+
+	for(;;){
+		int n = size1[0];
+		int batchable = (size1[1] == n && n >= SMALL_MIN && n <= SMALL_MAX);
+		if(op == 'm'){
+			batchable = batchable && size2[0] == n && size2[1] == n;
+		}
+		if(bt->filled > 0 && (!batchable || n != bt->n)){
+			batch_flush(bt, op, out);
+		}
+
+		if(first_product != NULL){
+			int sizem[2] = {size1[0], size2[1]};
+			print_block(out, first_product, sizem, 0);
+			first_product = NULL;
+		}else if(batchable){
+			bt->n = n;
+			batch_put(bt->a, matrix1, bt->filled, n);
+			if(op == 'm'){
+				batch_put(bt->b, matrix2, bt->filled, n);
+			}
+			if(++bt->filled == LANES){
+				batch_flush(bt, op, out);
+			}
+		}else if(op == 'm'){
+			if(size1[1] != size2[0]){
+				printf("Matrices %ld can not be multiplied\n", done+1);
+				break;
+			}
+			int sizem[2] = {size1[0], size2[1]};
+			size_t need = (size_t)sizem[0]*sizem[1];
+			if(need > space_r){
+				result = realloc(result, need*sizeof(long double));
+				space_r = need;
+			}
+			multiply(matrix1, matrix2, result, size1, size2);
+			print_block(out, result, sizem, 0);
+		}else{
+			if(size1[1] != n){
+				printf("Matrix %ld must be square\n", done+1);
+				break;
+			}
+			if(op == 'd'){
+				printf("%LF\n", determinant(matrix1, n, &hint));
+			}else{
+				size_t need = (size_t)n*n;
+				if(need > space_r){
+					result = realloc(result, need*sizeof(long double));
+					space_r = need;
+				}
+				inverse(matrix1, result, n, &hint);
+				print_block(out, result, size1, 1);
+			}
+		}
+		done++;
+
+		/*read the next block, or the next pair for -m*/
+		if(!more_blocks(in1)){
+			break;
+		}
+		in1->pending = 0;
+		size1[0] = in1->size[0], size1[1] = in1->size[1];
+		hint = in1->hint;
+		size_t need1 = (size_t)size1[0]*size1[1];
+		if(need1 > space1){
+			/*grow the buffers if this block is bigger than any before*/
+			matrix1 = realloc(matrix1, need1*sizeof(long double));
+			space1 = need1;
+		}
+		if(!read_body(in1->fp, size1, matrix1)){
+			printf("Matrix %ld of %s is incomplete\n", done+1, in1->name);
+			break;
+		}
+		if(op == 'm'){
+			if(!more_blocks(in2)){
+				printf("%s has fewer matrices than %s\n", in2->name, in1->name);
+				break;
+			}
+			in2->pending = 0;
+			size2[0] = in2->size[0], size2[1] = in2->size[1];
+			size_t need2 = (size_t)size2[0]*size2[1];
+			if(need2 > space2){
+				matrix2 = realloc(matrix2, need2*sizeof(long double));
+				space2 = need2;
+			}
+			if(!read_body(in2->fp, size2, matrix2)){
+				printf("Matrix %ld of %s is incomplete\n", done+1, in2->name);
+				break;
+			}
+		}
+	}
+	batch_flush(bt, op, out);
+
+	if(bt->singular > 0){
+		printf("%ld singular matrices have no inverse\n", bt->singular);
+	}
+
+finish:
+	close_input(in1);
+	if(in2 != NULL) close_input(in2);
+	if(out != NULL) fclose(out);
+	free(matrix1);
+	free(matrix2);
+	free(result);
+	free(bt);
+	return done;
+}
+
+/*
+======================================================================================================
+Out of core multiply and transpose.
+
+The text inputs are copied once into raw files of doubles in row major order
+after a RAW_HEADER byte header, so any tile can be read with one pread per
+row. Tiles are square, sized so that all of the tile buffers fit within the
+memory limit, and there are two of each kind so one can be read or written
+by the I/O thread while the other is being worked on.
+======================================================================================================
+*/
+
+#define RAW_MAGIC "MATRAW1"
+#define RAW_HEADER 64 /*bytes before the data in a raw file*/
+
+struct raw_header {
+	char magic[8];
+	int64_t rows;
+	int64_t cols;
+	uint64_t text_size;/*size and modification time of the text file copied*/
+	int64_t text_sec, text_nsec;
+	char unused[RAW_HEADER-48];
+};
+
+/*A tile to be read from or written to a raw file by the I/O thread*/
+struct tile_io {
+	int fd;
+	int write;
+	double *buf;/*rows x cols, packed*/
+	long long row, col;/*top left element of the tile in the file*/
+	long long rows, cols;
+	long long ld;/*columns of the whole matrix in the file*/
+	int done;
+	int failed;
+	struct tile_io *next;
+};
+
+/*Queue of tile transfers, done in order by a single I/O thread*/
+struct io_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t finished;
+	struct tile_io *head, *tail;
+	int stop;
+	pthread_t thread;
+};
+
+/*Function moves one tile between memory and its raw file, returns 1 on failure*/
+static int tile_transfer(struct tile_io *t){
+	for(long long r = 0; r < t->rows; r++){
+		off_t offset = RAW_HEADER + ((t->row+r)*t->ld + t->col)*(off_t)sizeof(double);
+		char *p = (char *)(t->buf + r*t->cols);
+		size_t left = t->cols*sizeof(double);
+		while(left > 0){
+			ssize_t moved = t->write ? pwrite(t->fd, p, left, offset) : pread(t->fd, p, left, offset);
+			if(moved <= 0){
+				return 1;
+			}
+			p += moved;
+			offset += moved;
+			left -= moved;
+		}
+	}
+	return 0;
+}
+
+static void *io_thread(void *arg){
+	struct io_queue *q = arg;
+	pthread_mutex_lock(&q->lock);
+	while(1){
+		while(q->head == NULL && !q->stop){
+			pthread_cond_wait(&q->wake, &q->lock);
+		}
+		if(q->head == NULL){
+			break;
+		}
+		struct tile_io *t = q->head;
+		q->head = t->next;
+		if(q->head == NULL){
+			q->tail = NULL;
+		}
+		pthread_mutex_unlock(&q->lock);
+		int failed = tile_transfer(t);
+		pthread_mutex_lock(&q->lock);
+		t->failed = failed;
+		t->done = 1;
+		pthread_cond_broadcast(&q->finished);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return NULL;
+}
+
+static void io_start(struct io_queue *q){
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->wake, NULL);
+	pthread_cond_init(&q->finished, NULL);
+	q->head = q->tail = NULL;
+	q->stop = 0;
+	pthread_create(&q->thread, NULL, io_thread, q);
+}
+
+/*Function lets the I/O thread finish what is queued and then stops it*/
+static void io_stop(struct io_queue *q){
+	pthread_mutex_lock(&q->lock);
+	q->stop = 1;
+	pthread_cond_signal(&q->wake);
+	pthread_mutex_unlock(&q->lock);
+	pthread_join(q->thread, NULL);
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->wake);
+	pthread_cond_destroy(&q->finished);
+}
+
+/*Function queues a tile transfer and returns straight away*/
+static void io_submit(struct io_queue *q, struct tile_io *t, int fd, int write, long long row, long long col,
+		long long rows, long long cols, long long ld){
+	t->fd = fd;
+	t->write = write;
+	t->row = row;
+	t->col = col;
+	t->rows = rows;
+	t->cols = cols;
+	t->ld = ld;
+	t->next = NULL;
+	pthread_mutex_lock(&q->lock);
+	t->done = 0;
+	t->failed = 0;
+	if(q->tail != NULL){
+		q->tail->next = t;
+	}else{
+		q->head = t;
+	}
+	q->tail = t;
+	pthread_cond_signal(&q->wake);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/*Function waits for a queued transfer to be done, returns 1 if it failed*/
+static int io_wait(struct io_queue *q, struct tile_io *t){
+	pthread_mutex_lock(&q->lock);
+	while(!t->done){
+		pthread_cond_wait(&q->finished, &q->lock);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return t->failed;
+}
+
+/*
+Function opens the raw copy of a text matrix file, making it first unless
+there is one whose header records the text file's current size and time.
+The values are read one at a time so the matrix never has to fit in memory.
+Returns a descriptor, or -1 on failure.
+*/
+static int open_raw(char *filename, long long *size){
+	char raw_name[4096];
+	struct stat text_st;
+	struct raw_header header;
+	int fd;
+
+	snprintf(raw_name, sizeof(raw_name), "%s.raw", filename);
+	if(stat(filename, &text_st) != 0){
+		printf("File could not open %s\n", filename);
+		return -1;
+	}
+	fd = open(raw_name, O_RDONLY);
+	if(fd >= 0){
+		if(pread(fd, &header, sizeof(header), 0) == sizeof(header)
+				&& memcmp(header.magic, RAW_MAGIC, sizeof(header.magic)) == 0
+				&& header.text_size == (uint64_t)text_st.st_size
+				&& header.text_sec == text_st.st_mtime && header.text_nsec == MTIME_NSEC(text_st)){
+			size[0] = header.rows;
+			size[1] = header.cols;
+			printf("%s contains matrix of %lld by %lld (using %s)\n", filename, size[0], size[1], raw_name);
+			return fd;
+		}
+		close(fd);
+	}
+
+	FILE *in = fopen(filename, "r");
+	FILE *out = fopen(raw_name, "wb");
+	int text_size[2];
+	int ok = (in != NULL && out != NULL && read_header(in, text_size, NULL, NULL));
+	if(ok){
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, RAW_MAGIC, sizeof(header.magic));
+		header.rows = size[0] = text_size[0];
+		header.cols = size[1] = text_size[1];
+		header.text_size = text_st.st_size;
+		header.text_sec = text_st.st_mtime;
+		header.text_nsec = MTIME_NSEC(text_st);
+		ok = (fwrite(&header, sizeof(header), 1, out) == 1);
+	}
+	if(ok){
+		double buffer[4096];
+		long long count = size[0]*size[1];
+		int used = 0;
+		for(long long k = 0; k < count && ok; k++){
+			ok = (fscanf(in, "%lf", &buffer[used++]) == 1);
+			if(used == 4096 || k == count-1){
+				ok = ok && (fwrite(buffer, sizeof(double), used, out) == (size_t)used);
+				used = 0;
+			}
+		}
+	}
+	if(in != NULL) fclose(in);
+	if(out != NULL && fclose(out) != 0) ok = 0;
+	if(!ok){
+		printf("Could not make raw copy %s of %s\n", raw_name, filename);
+		remove(raw_name);
+		return -1;
+	}
+	printf("%s contains matrix of %lld by %lld (copied to %s)\n", filename, size[0], size[1], raw_name);
+	return open(raw_name, O_RDONLY);
+}
+
+/*Function makes an empty raw file of the given size to write tiles into*/
+static int create_raw(char *raw_name, long long rows, long long cols){
+	struct raw_header header;
+	int fd = open(raw_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0){
+		return -1;
+	}
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RAW_MAGIC, sizeof(header.magic));
+	header.rows = rows;
+	header.cols = cols;
+	if(pwrite(fd, &header, sizeof(header), 0) != sizeof(header)
+			|| ftruncate(fd, RAW_HEADER + rows*cols*(off_t)sizeof(double)) != 0){
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*Function writes a raw result out as a text file in the usual format, a row at a time*/
+static int raw_to_text(int fd, long long rows, long long cols, char *output_file, int argc, char **argv){
+	FILE *fp = fopen(output_file, "w");
+	double *row = malloc(cols*sizeof(double));
+	int ok = (fp != NULL && row != NULL);
+	if(ok){
+		print_header(fp, argc, argv);
+		fprintf(fp, "matrix %lld %lld\n", rows, cols);
+	}
+	for(long long i = 0; i < rows && ok; i++){
+		ssize_t want = cols*sizeof(double);
+		ok = (pread(fd, row, want, RAW_HEADER + i*want) == want);
+		for(long long j = 0; j < cols && ok; j++){
+			fprintf(fp, "%f	", row[j]);
+		}
+		fprintf(fp, "\n");
+	}
+	if(fp != NULL){
+		fprintf(fp, "end\n");
+		fclose(fp);
+	}
+	free(row);
+	return ok;
+}
+
+/*Function picks the side of a square tile so that 'buffers' of them fit in mem_limit*/
+static long long tile_side(long long mem_limit, int buffers, long long biggest){
+	long long side = (long long)sqrt((double)mem_limit/(buffers*sizeof(double)));
+	if(side > biggest) side = biggest;
+	if(side < 1) side = 1;
+	return side;
+}
+
+/*Function adds the product of an A tile and a B tile to a C tile*/
+static void tile_multiply(const double *a, const double *b, double *c, long long rows, long long inner, long long cols){
+	for(long long i = 0; i < rows; i++){
+		double *c_row = c + i*cols;
+		for(long long k = 0; k < inner; k++){
+			double a_ik = a[i*inner+k];
+			const double *b_row = b + k*cols;
+			if(a_ik == 0.0){
+				continue;
+			}
+			for(long long j = 0; j < cols; j++){
+				c_row[j] += a_ik*b_row[j];
+			}
+		}
+	}
+}
+
+/*Size of tile number t along a dimension of length len cut into tiles of side*/
+static long long tile_len(long long t, long long side, long long len){
+	return (len - t*side < side) ? len - t*side : side;
+}
+
+/*
+Function multiplies two raw matrices tile by tile. Step s works on A(ti,tk)
+and B(tk,tj), with tk changing fastest so each C tile is finished in a run of
+steps and can then be written behind while the next one is worked on.
+*/
+static int ooc_multiply(struct io_queue *q, int fd_a, int fd_b, int fd_c, long long m, long long inner, long long n,
+		long long mem_limit){
+	long long biggest = (m > n) ? m : n;
+	if(inner > biggest) biggest = inner;
+	long long side = tile_side(mem_limit, 6, biggest);
+	long long nti = (m+side-1)/side, ntj = (n+side-1)/side, ntk = (inner+side-1)/side;
+	long long steps = nti*ntj*ntk;
+	struct tile_io a_io[2], b_io[2], c_io[2];
+	int failed = 0;
+
+	printf("Working in %lld x %lld tiles\n", side, side);
+	for(int slot = 0; slot < 2; slot++){
+		a_io[slot].buf = malloc(side*side*sizeof(double));
+		b_io[slot].buf = malloc(side*side*sizeof(double));
+		c_io[slot].buf = malloc(side*side*sizeof(double));
+		a_io[slot].done = b_io[slot].done = c_io[slot].done = 1;
+		a_io[slot].failed = b_io[slot].failed = c_io[slot].failed = 0;
+		if(!a_io[slot].buf || !b_io[slot].buf || !c_io[slot].buf){
+			failed = 1;
+		}
+	}
+
+	for(long long s = 0; s < steps + 1 && !failed; s++){
+		/*queue the reads for step s, then work on step s-1 while they happen*/
+		if(s < steps){
+			long long tk = s % ntk, tj = (s/ntk) % ntj, ti = s/(ntk*ntj);
+			int slot = s & 1;
+			io_submit(q, &a_io[slot], fd_a, 0, ti*side, tk*side,
+				tile_len(ti, side, m), tile_len(tk, side, inner), inner);
+			io_submit(q, &b_io[slot], fd_b, 0, tk*side, tj*side,
+				tile_len(tk, side, inner), tile_len(tj, side, n), n);
+		}
+		if(s == 0){
+			continue;
+		}
+		long long p = s-1;
+		long long tk = p % ntk, tj = (p/ntk) % ntj, ti = p/(ntk*ntj);
+		int slot = p & 1;
+		int c_slot = (p/ntk) & 1;
+		failed |= io_wait(q, &a_io[slot]) | io_wait(q, &b_io[slot]);
+		if(tk == 0){
+			/*the C buffer is free once the tile before last has been written*/
+			failed |= io_wait(q, &c_io[c_slot]);
+			memset(c_io[c_slot].buf, 0, side*side*sizeof(double));
+		}
+		tile_multiply(a_io[slot].buf, b_io[slot].buf, c_io[c_slot].buf,
+			a_io[slot].rows, a_io[slot].cols, b_io[slot].cols);
+		if(tk == ntk-1){
+			io_submit(q, &c_io[c_slot], fd_c, 1, ti*side, tj*side,
+				tile_len(ti, side, m), tile_len(tj, side, n), n);
+		}
+	}
+	for(int slot = 0; slot < 2; slot++){
+		failed |= io_wait(q, &a_io[slot]) | io_wait(q, &b_io[slot]) | io_wait(q, &c_io[slot]);
+		free(a_io[slot].buf);
+		free(b_io[slot].buf);
+		free(c_io[slot].buf);
+	}
+	return !failed;
+}
+
+/*
+Function transposes a raw matrix tile by tile, tile (ti,tj) of A becoming
+tile (tj,ti) of the result, reading the next tile and writing the last one
+while the current one is transposed.
+*/
+static int ooc_transpose(struct io_queue *q, int fd_a, int fd_t, long long rows, long long cols, long long mem_limit){
+	long long side = tile_side(mem_limit, 4, (rows > cols) ? rows : cols);
+	long long nti = (rows+side-1)/side, ntj = (cols+side-1)/side;
+	long long steps = nti*ntj;
+	struct tile_io in_io[2], out_io[2];
+	int failed = 0;
+
+	printf("Working in %lld x %lld tiles\n", side, side);
+	for(int slot = 0; slot < 2; slot++){
+		in_io[slot].buf = malloc(side*side*sizeof(double));
+		out_io[slot].buf = malloc(side*side*sizeof(double));
+		in_io[slot].done = out_io[slot].done = 1;
+		in_io[slot].failed = out_io[slot].failed = 0;
+		if(!in_io[slot].buf || !out_io[slot].buf){
+			failed = 1;
+		}
+	}
+
+	for(long long s = 0; s < steps + 1 && !failed; s++){
+		if(s < steps){
+			long long ti = s/ntj, tj = s % ntj;
+			io_submit(q, &in_io[s & 1], fd_a, 0, ti*side, tj*side,
+				tile_len(ti, side, rows), tile_len(tj, side, cols), cols);
+		}
+		if(s == 0){
+			continue;
+		}
+		long long p = s-1;
+		long long ti = p/ntj, tj = p % ntj;
+		struct tile_io *in = &in_io[p & 1], *out = &out_io[p & 1];
+		failed |= io_wait(q, in) | io_wait(q, out);
+		for(long long i = 0; i < in->rows; i++){
+			for(long long j = 0; j < in->cols; j++){
+				out->buf[in->rows*j+i] = in->buf[in->cols*i+j];
+			}
+		}
+		io_submit(q, out, fd_t, 1, tj*side, ti*side, in->cols, in->rows, rows);
+	}
+	for(int slot = 0; slot < 2; slot++){
+		failed |= io_wait(q, &in_io[slot]) | io_wait(q, &out_io[slot]);
+		free(in_io[slot].buf);
+		free(out_io[slot].buf);
+	}
+	return !failed;
+}
+
+/*
+Function runs -m or -t out of core, keeping within mem_limit bytes for the
+tiles. The result is left in output_file.raw and written out to output_file.
+Returns 1 if it worked.
+*/
+int run_out_of_core(char op, char *filename1, char *filename2, char *output_file, long long mem_limit, int argc, char **argv){
+	long long size1[2], size2[2], sizer[2];
+	char raw_name[4096];
+	int fd1 = -1, fd2 = -1, fd_r = -1;
+	int ok = 0;
+	struct io_queue q;
+
+	if((fd1 = open_raw(filename1, size1)) < 0){
+		goto finish;
+	}
+	if(op == 'm'){
+		if((fd2 = open_raw(filename2, size2)) < 0){
+			goto finish;
+		}
+		if(size1[1] != size2[0]){
+			printf("Number of columns of the first matrix must equal the number of rows of the second\n");
+			goto finish;
+		}
+		sizer[0] = size1[0];
+		sizer[1] = size2[1];
+	}else{
+		sizer[0] = size1[1];
+		sizer[1] = size1[0];
+	}
+	snprintf(raw_name, sizeof(raw_name), "%s.raw", output_file);
+	if((fd_r = create_raw(raw_name, sizer[0], sizer[1])) < 0){
+		printf("Could not open %s for writing\n", raw_name);
+		goto finish;
+	}
+
+	io_start(&q);
+	if(op == 'm'){
+		ok = ooc_multiply(&q, fd1, fd2, fd_r, size1[0], size1[1], size2[1], mem_limit);
+	}else{
+		ok = ooc_transpose(&q, fd1, fd_r, size1[0], size1[1], mem_limit);
+	}
+	io_stop(&q);
+
+	if(!ok){
+		printf("Reading or writing a tile failed\n");
+		goto finish;
+	}
+	ok = raw_to_text(fd_r, sizer[0], sizer[1], output_file, argc, argv);
+	if(ok){
+		printf("Result of %lld by %lld written to %s and %s\n", sizer[0], sizer[1], raw_name, output_file);
+	}
+
+finish:
+	if(fd1 >= 0) close(fd1);
+	if(fd2 >= 0) close(fd2);
+	if(fd_r >= 0) close(fd_r);
+	return ok;
+}
+
+/*
+======================================================================================================
+Low rank updates of an inverse.
+
+Each changed row i is the rank one change e_i d^T and each changed column j
+is d e_j^T, where d is the new row or column less the old one, so k changes
+make A' = A + U V^T with U and V n x k. Then
+	A'^-1 = A^-1 - A^-1 U (I + V^T A^-1 U)^-1 V^T A^-1
+	det(A') = det(A) det(I + V^T A^-1 U)
+which only needs products of A^-1 with vectors, O(k n^2) in all.
+======================================================================================================
+*/
+
+/*One changed row or column, with d the new values less the old ones*/
+struct change {
+	int is_row;
+	int index;
+	long double *d;
+};
+
+/*
+Function reads the changes in a delta file, applying each to matrix as it
+goes so that d is always taken against the matrix as changed so far and the
+rank one terms add up to the whole change. Returns the number of changes, or
+-1 if the file is broken.
+*/
+static int read_changes(char *filename, long double *matrix, int n, struct change **changes){
+	FILE *fp = fopen(filename, "r");
+	char word[16];
+	int count = 0, space = 0, broken = 0;
+	*changes = NULL;
+	if(fp == NULL){
+		printf("File could not open %s\n", filename);
+		return -1;
+	}
+	while(!broken && fscanf(fp, " %15s", word) == 1 && strcmp(word, "end") != 0){
+		if(word[0] == '#'){
+			int ch;
+			while((ch = fgetc(fp)) != EOF && ch != '\n');
+			continue;
+		}
+		struct change c;
+		c.is_row = (strcmp(word, "row") == 0);
+		if((!c.is_row && strcmp(word, "col") != 0) || fscanf(fp, "%d", &c.index) != 1
+				|| c.index < 0 || c.index >= n){
+			printf("Bad change '%s' in %s\n", word, filename);
+			broken = 1;
+			break;
+		}
+		c.d = malloc(n*sizeof(long double));
+		for(int k = 0; k < n; k++){
+			long double value;
+			if(fscanf(fp, "%Lf", &value) != 1){
+				printf("Change %d in %s is short\n", count+1, filename);
+				broken = 1;
+				break;
+			}
+			long double *old = c.is_row ? &matrix[n*c.index+k] : &matrix[n*k+c.index];
+			c.d[k] = value - *old;
+			*old = value;
+		}
+		if(broken){
+			free(c.d);
+			break;
+		}
+		if(count == space){
+			space = 2*space + 4;
+			*changes = realloc(*changes, space*sizeof(struct change));
+		}
+		(*changes)[count++] = c;
+	}
+	fclose(fp);
+	if(broken){
+		for(int p = 0; p < count; p++){
+			free((*changes)[p].d);
+		}
+		free(*changes);
+		*changes = NULL;
+		return -1;
+	}
+	return count;
+}
+
+/*
+Function checks how well inverse_mat inverts matrix with a fixed probe vector
+z, returning ||A (X z) - z|| / ||z|| in O(n^2) time.
+*/
+static long double probe_residual(long double *matrix, long double *inverse_mat, int n){
+	long double *z = malloc(3*n*sizeof(long double));
+	long double *y = z + n, *r = y + n;
+	long double worst = 0.0, size = 0.0;
+	unsigned int seed = 12345;
+	for(int i = 0; i < n; i++){
+		seed = seed*1103515245u + 12345u;
+		z[i] = ((seed >> 16) & 0x7fff)/32768.0 - 0.5;
+		if(fabsl(z[i]) > size) size = fabsl(z[i]);
+	}
+	for(int i = 0; i < n; i++){
+		long double sum = 0.0;
+		for(int k = 0; k < n; k++){
+			sum += inverse_mat[n*i+k]*z[k];
+		}
+		y[i] = sum;
+	}
+	for(int i = 0; i < n; i++){
+		long double sum = -z[i];
+		for(int k = 0; k < n; k++){
+			sum += matrix[n*i+k]*y[k];
+		}
+		r[i] = sum;
+		if(fabsl(sum) > worst) worst = fabsl(sum);
+	}
+	free(z);
+	return worst/size;
+}
+
+/*
+Function updates the inverse and determinant of a matrix for the changes in
+a delta file, falling back to a full inverse if the update loses accuracy.
+Returns 1 if it worked.
+*/
+int run_update(char *matrix_file, char *inverse_file, char *delta_file, char *output_file, int argc, char **argv){
+	int size[2], size_inv[2];
+	struct change *changes = NULL;
+	long double *matrix = NULL, *old_inverse = NULL, *new_inverse = NULL;
+	long double *z = NULL, *y = NULL, *cap = NULL;
+	int *perm = NULL;
+	int k = 0, ok = 0;
+	struct input in_matrix, in_inverse;
+
+	if(!open_input(&in_matrix, matrix_file) || !get_size(&in_matrix, size, NULL)){
+		return 0;
+	}
+	if(!open_input(&in_inverse, inverse_file) || !get_size(&in_inverse, size_inv, NULL)){
+		close_input(&in_matrix);
+		return 0;
+	}
+	if(size[0] != size[1] || size_inv[0] != size[0] || size_inv[1] != size[1]){
+		printf("Matrix and inverse must be square and the same size\n");
+		close_input(&in_matrix);
+		close_input(&in_inverse);
+		return 0;
+	}
+	int n = size[0];
+	size_t nn = (size_t)n*n;
+	matrix = malloc(nn*sizeof(long double));
+	old_inverse = malloc(nn*sizeof(long double));
+	new_inverse = malloc(nn*sizeof(long double));
+	int loaded = get_matrix(&in_matrix, size, matrix) && get_matrix(&in_inverse, size, old_inverse);
+	long double det = in_inverse.det;/*noted by -i in the header just read*/
+	close_input(&in_matrix);
+	close_input(&in_inverse);
+	if(!loaded){
+		goto finish;
+	}
+	echo_matrix(matrix, size);
+	echo_matrix(old_inverse, size);
+	long double old_error = probe_residual(matrix, old_inverse, n);
+
+	if((k = read_changes(delta_file, matrix, n, &changes)) < 0){
+		goto finish;
+	}
+	printf("%d rows or columns changed\n", k);
+
+	/*Z = A^-1 U (n x k) and Y = V^T A^-1 (k x n)*/
+	z = malloc(((size_t)n*k + (size_t)k*n + (size_t)k*k + 1)*sizeof(long double));
+	y = z + (size_t)n*k;
+	cap = y + (size_t)k*n;
+	perm = malloc((k+1)*sizeof(int));
+	for(int p = 0; p < k; p++){
+		struct change *c = &changes[p];
+		for(int i = 0; i < n; i++){
+			long double zi = 0.0, yi = 0.0;
+			if(c->is_row){
+				/*U column is e_i, V column is d*/
+				zi = old_inverse[n*i+c->index];
+				for(int j = 0; j < n; j++){
+					yi += c->d[j]*old_inverse[n*j+i];
+				}
+			}else{
+				/*U column is d, V column is e_j*/
+				for(int j = 0; j < n; j++){
+					zi += old_inverse[n*i+j]*c->d[j];
+				}
+				yi = old_inverse[n*c->index+i];
+			}
+			z[(size_t)k*i+p] = zi;
+			y[(size_t)n*p+i] = yi;
+		}
+	}
+	/*capacitance matrix I + V^T Z*/
+	for(int p = 0; p < k; p++){
+		struct change *c = &changes[p];
+		for(int q = 0; q < k; q++){
+			long double sum = (p == q) ? 1.0 : 0.0;
+			if(c->is_row){
+				for(int j = 0; j < n; j++){
+					sum += c->d[j]*z[(size_t)k*j+q];
+				}
+			}else{
+				sum += z[(size_t)k*c->index+q];
+			}
+			cap[k*p+q] = sum;
+		}
+	}
+	/*Y = (I + V^T Z)^-1 V^T A^-1, then A'^-1 = A^-1 - Z Y*/
+	long double cap_det = lu_factor(cap, perm, k);
+	for(int p = 0; p < k; p++){
+		cap_det *= cap[k*p+p];
+	}
+	if(cap_det != 0.0){
+		lu_solve(cap, perm, k, y, n);
+	}
+	memcpy(new_inverse, old_inverse, nn*sizeof(long double));
+	for(int i = 0; i < n; i++){
+		for(int p = 0; p < k; p++){
+			long double f = z[(size_t)k*i+p];
+			for(int j = 0; j < n; j++){
+				new_inverse[n*i+j] -= f*y[(size_t)n*p+j];
+			}
+		}
+	}
+	det *= cap_det;
+
+	/*the update can't be better than the old inverse, but shouldn't be much worse*/
+	long double new_error = probe_residual(matrix, new_inverse, n);
+	if(cap_det == 0.0 || !(new_error <= 10*old_error || new_error <= 1000*n*LDBL_EPSILON)){
+		printf("Updated inverse has residual %Lg against %Lg before, working it out again\n", new_error, old_error);
+		det = inverse(matrix, new_inverse, n, NULL);
+	}else{
+		printf("Inverse updated, residual %Lg against %Lg before\n", new_error, old_error);
+	}
+	if(!isnan(det)){
+		printf("determinant is %LF\n", det);
+	}
+
+	print_exact_file(new_inverse, size, det, output_file, argc, argv);
+	/*the changed matrix is named after the output, output_updated.txt for output.txt*/
+	char updated_name[FILENAME_MAX];
+	char *dot = strrchr(output_file, '.');
+	int stem = (dot != NULL && strchr(dot, '/') == NULL) ? (int)(dot - output_file) : (int)strlen(output_file);
+	snprintf(updated_name, sizeof(updated_name), "%.*s_updated%s", stem, output_file, output_file + stem);
+	print_exact_file(matrix, size, NAN, updated_name, argc, argv);
+	printf("Changed matrix written to %s\n", updated_name);
+	ok = 1;
+
+finish:
+	for(int p = 0; p < k; p++){
+		free(changes[p].d);
+	}
+	free(changes);
+	free(matrix);
+	free(old_inverse);
+	free(new_inverse);
+	free(z);
+	free(perm);
+	return ok;
+}
+
+/*
+======================================================================================================
+Sharded work over several processes.
+
+The coordinator puts the operands in a POSIX shared memory object laid out as
+a struct shm_header followed by the matrices, and talks to each worker over
+its own Unix stream socket. Every message is a struct message, the same size
+and holding only numbers and the shared memory name, so the protocol could be
+carried over a network link to workers on another host with their own copy
+of the data. Jobs are handed out one at a time to whichever worker is free.
+======================================================================================================
+*/
+
+#define MSG_MAGIC 0x4d415454u /*'MATT'*/
+#define SHARD_TILE 128 /*side of the product tiles handed out*/
+#define SHARD_PANEL 64 /*columns in each panel of the blocked LU*/
+
+enum message_type {
+	MSG_ATTACH = 1,/*map the shared memory named in name, arg[0] bytes*/
+	MSG_MULTIPLY,/*C rows arg[0]..arg[1]-1, columns arg[2]..arg[3]-1*/
+	MSG_UPDATE,/*trailing update after the panel at arg[0] of width arg[1], rows arg[2]..arg[3]-1*/
+	MSG_SOLVE,/*solve L U X = P I for columns arg[0]..arg[1]-1 of X*/
+	MSG_DONE,/*reply to any of the above, arg[0] is 0 if it worked*/
+	MSG_QUIT
+};
+
+struct message {
+	uint32_t magic;
+	uint32_t type;
+	int64_t arg[4];
+	char name[48];
+};
+
+/*Start of the shared memory, offsets are in bytes from the start*/
+struct shm_header {
+	int64_t m, k, n;/*A is m x k and B is k x n, for an inverse m = k = n*/
+	int64_t a, b, c;/*offsets of A (or LU), B and C (or X)*/
+};
+
+/*Coordinator's view of its workers*/
+struct pool {
+	int count;
+	int *fd;
+	pid_t *pid;
+	char name[48];
+	int created;/*does the shared memory name still need removing?*/
+	size_t size;
+	char *base;
+	struct shm_header *header;
+};
+
+/*
+Functions move a whole message, returning 0 if the other end has gone.
+MSG_NOSIGNAL turns a dead worker into an EPIPE error instead of a SIGPIPE.
+*/
+static int send_message(int fd, struct message *msg){
+	char *p = (char *)msg;
+	size_t left = sizeof(*msg);
+	while(left > 0){
+		ssize_t sent = send(fd, p, left, MSG_NOSIGNAL);
+		if(sent < 0 && errno == EINTR){
+			continue;
+		}
+		if(sent <= 0){
+			return 0;
+		}
+		p += sent;
+		left -= sent;
+	}
+	return 1;
+}
+
+static int receive_message(int fd, struct message *msg){
+	char *p = (char *)msg;
+	size_t left = sizeof(*msg);
+	while(left > 0){
+		ssize_t got = read(fd, p, left);
+		if(got < 0 && errno == EINTR){
+			continue;
+		}
+		if(got <= 0){
+			return 0;
+		}
+		p += got;
+		left -= got;
+	}
+	return msg->magic == MSG_MAGIC;
+}
+
+/*Worker's part of C = A B for a tile of C*/
+static void shard_multiply_tile(char *base, struct shm_header *h, int64_t r0, int64_t r1, int64_t c0, int64_t c1){
+	long double *a = (long double *)(base + h->a), *b = (long double *)(base + h->b), *c = (long double *)(base + h->c);
+	for(int64_t i = r0; i < r1; i++){
+		long double *c_row = c + h->n*i;
+		for(int64_t j = c0; j < c1; j++){
+			c_row[j] = 0.0;
+		}
+		for(int64_t p = 0; p < h->k; p++){
+			long double a_ip = a[h->k*i+p];
+			const long double *b_row = b + h->n*p;
+			for(int64_t j = c0; j < c1; j++){
+				c_row[j] += a_ip*b_row[j];
+			}
+		}
+	}
+}
+
+/*Worker's part of A22 = A22 - L21 U12 for some rows of A22*/
+static void shard_update_rows(char *base, struct shm_header *h, int64_t k0, int64_t kb, int64_t r0, int64_t r1){
+	long double *lu = (long double *)(base + h->a);
+	int64_t n = h->n;
+	for(int64_t i = r0; i < r1; i++){
+		long double *row_i = lu + n*i;
+		for(int64_t p = k0; p < k0+kb; p++){
+			long double l_ip = row_i[p];
+			const long double *row_p = lu + n*p;
+			if(l_ip == 0.0){
+				continue;
+			}
+			for(int64_t j = k0+kb; j < n; j++){
+				row_i[j] -= l_ip*row_p[j];
+			}
+		}
+	}
+}
+
+/*Worker's part of the inverse, substitution for some columns of X*/
+static void shard_solve_columns(char *base, struct shm_header *h, int64_t c0, int64_t c1){
+	long double *lu = (long double *)(base + h->a), *x = (long double *)(base + h->c);
+	int64_t n = h->n;
+	for(int64_t k = 0; k < n; k++){
+		for(int64_t i = k+1; i < n; i++){
+			long double f = lu[n*i+k];
+			if(f == 0.0){
+				continue;
+			}
+			for(int64_t j = c0; j < c1; j++){
+				x[n*i+j] -= f*x[n*k+j];
+			}
+		}
+	}
+	for(int64_t k = n-1; k >= 0; k--){
+		long double rcp = 1.0/lu[n*k+k];
+		for(int64_t j = c0; j < c1; j++){
+			x[n*k+j] *= rcp;
+		}
+		for(int64_t i = 0; i < k; i++){
+			long double f = lu[n*i+k];
+			if(f == 0.0){
+				continue;
+			}
+			for(int64_t j = c0; j < c1; j++){
+				x[n*i+j] -= f*x[n*k+j];
+			}
+		}
+	}
+}
+
+/*Function run by each worker process, doing jobs until told to quit*/
+static void worker_loop(int fd){
+	char *base = NULL;
+	size_t size = 0;
+	struct message msg;
+	while(receive_message(fd, &msg) && msg.type != MSG_QUIT){
+		int failed = 0;
+		if(msg.type == MSG_ATTACH){
+			int shm = shm_open(msg.name, O_RDWR, 0);
+			if(base != NULL){
+				munmap(base, size);
+			}
+			size = msg.arg[0];
+			base = (shm < 0) ? MAP_FAILED : mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+			if(shm >= 0){
+				close(shm);
+			}
+			if(base == MAP_FAILED){
+				base = NULL;
+				failed = 1;
+			}
+		}else if(base == NULL){
+			failed = 1;
+		}else if(msg.type == MSG_MULTIPLY){
+			shard_multiply_tile(base, (struct shm_header *)base, msg.arg[0], msg.arg[1], msg.arg[2], msg.arg[3]);
+		}else if(msg.type == MSG_UPDATE){
+			shard_update_rows(base, (struct shm_header *)base, msg.arg[0], msg.arg[1], msg.arg[2], msg.arg[3]);
+		}else if(msg.type == MSG_SOLVE){
+			shard_solve_columns(base, (struct shm_header *)base, msg.arg[0], msg.arg[1]);
+		}else{
+			failed = 1;
+		}
+		msg.type = MSG_DONE;
+		msg.arg[0] = failed;
+		if(!send_message(fd, &msg)){
+			break;
+		}
+	}
+	if(base != NULL){
+		munmap(base, size);
+	}
+}
+
+/*
+Function hands out the jobs to the workers, a new one to each worker as soon
+as it replies, and waits for them all. Returns 1 if every job worked.
+*/
+static int farm_out(struct pool *pool, struct message *jobs, int njobs){
+	struct pollfd *fds = malloc(pool->count*sizeof(struct pollfd));
+	int next = 0, busy = 0, ok = 1;
+	for(int w = 0; w < pool->count; w++){
+		fds[w].fd = pool->fd[w];
+		fds[w].events = POLLIN;
+		if(next < njobs){
+			jobs[next].magic = MSG_MAGIC;
+			if(!send_message(pool->fd[w], &jobs[next++])){
+				ok = 0;
+			}
+			busy++;
+		}
+	}
+	while(busy > 0 && ok){
+		if(poll(fds, pool->count, -1) < 0){
+			ok = 0;
+			break;
+		}
+		for(int w = 0; w < pool->count; w++){
+			if(!(fds[w].revents & (POLLIN | POLLHUP | POLLERR))){
+				continue;
+			}
+			struct message reply;
+			if(!receive_message(pool->fd[w], &reply) || reply.type != MSG_DONE || reply.arg[0] != 0){
+				ok = 0;
+				break;
+			}
+			busy--;
+			if(next < njobs){
+				jobs[next].magic = MSG_MAGIC;
+				if(!send_message(pool->fd[w], &jobs[next++])){
+					ok = 0;
+					break;
+				}
+				busy++;
+			}
+		}
+	}
+	free(fds);
+	return ok;
+}
+
+/*Function tells the workers to quit and removes the shared memory*/
+static void pool_stop(struct pool *pool){
+	struct message msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.magic = MSG_MAGIC;
+	msg.type = MSG_QUIT;
+	for(int w = 0; w < pool->count; w++){
+		if(pool->fd[w] >= 0){
+			send_message(pool->fd[w], &msg);
+			close(pool->fd[w]);
+		}
+		if(pool->pid[w] > 0){
+			waitpid(pool->pid[w], NULL, 0);
+		}
+	}
+	if(pool->base != NULL){
+		munmap(pool->base, pool->size);
+	}
+	/*only remove a name this process made, not one that was already there*/
+	if(pool->created){
+		shm_unlink(pool->name);
+		pool->created = 0;
+	}
+	free(pool->fd);
+	free(pool->pid);
+}
+
+/*
+Function makes the shared memory with room for the given matrices and starts
+the workers, each attached to it. Returns 1 if it worked.
+*/
+static int pool_start(struct pool *pool, int workers, int64_t m, int64_t k, int64_t n, int with_b){
+	int64_t offset = (sizeof(struct shm_header) + 63)/64*64;
+	pool->count = workers;
+	pool->fd = malloc(workers*sizeof(int));
+	pool->pid = malloc(workers*sizeof(pid_t));
+	pool->base = NULL;
+	pool->created = 0;
+	for(int w = 0; w < workers; w++){
+		pool->fd[w] = -1;
+		pool->pid[w] = 0;
+	}
+	snprintf(pool->name, sizeof(pool->name), "/mat_test.%d", (int)getpid());
+
+	struct shm_header header = {m, k, n, 0, 0, 0};
+	header.a = offset;
+	offset += m*k*sizeof(long double);
+	if(with_b){
+		header.b = offset;
+		offset += k*n*sizeof(long double);
+	}
+	header.c = offset;
+	offset += m*n*sizeof(long double);
+	pool->size = offset;
+
+	int shm = shm_open(pool->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	pool->created = (shm >= 0);
+	if(shm < 0 || ftruncate(shm, pool->size) != 0){
+		printf("Could not make shared memory %s\n", pool->name);
+		if(shm >= 0) close(shm);
+		pool_stop(pool);
+		return 0;
+	}
+	pool->base = mmap(NULL, pool->size, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+	close(shm);
+	if(pool->base == MAP_FAILED){
+		pool->base = NULL;
+		pool_stop(pool);
+		return 0;
+	}
+	pool->header = (struct shm_header *)pool->base;
+	*pool->header = header;
+
+	fflush(stdout);
+	for(int w = 0; w < workers; w++){
+		int ends[2];
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0){
+			pool_stop(pool);
+			return 0;
+		}
+		pid_t pid = fork();
+		if(pid == 0){
+			/*the worker keeps only its own end of its own socket*/
+			close(ends[0]);
+			for(int v = 0; v < w; v++){
+				close(pool->fd[v]);
+			}
+			munmap(pool->base, pool->size);
+			worker_loop(ends[1]);
+			_exit(0);
+		}
+		close(ends[1]);
+		pool->pid[w] = pid;
+		pool->fd[w] = ends[0];
+		if(pid < 0){
+			pool_stop(pool);
+			return 0;
+		}
+	}
+
+	/*every worker maps the shared memory for itself*/
+	struct message *attach = calloc(workers, sizeof(struct message));
+	int ok = 1;
+	for(int w = 0; w < workers; w++){
+		attach[w].magic = MSG_MAGIC;
+		attach[w].type = MSG_ATTACH;
+		attach[w].arg[0] = pool->size;
+		strcpy(attach[w].name, pool->name);
+		ok = ok && send_message(pool->fd[w], &attach[w]);
+	}
+	for(int w = 0; w < workers && ok; w++){
+		struct message reply;
+		ok = receive_message(pool->fd[w], &reply) && reply.type == MSG_DONE && reply.arg[0] == 0;
+	}
+	free(attach);
+	if(!ok){
+		printf("Workers could not attach to shared memory\n");
+		pool_stop(pool);
+		return 0;
+	}
+	/*everyone has it mapped, so the name can go now and nothing is left behind if we die*/
+	shm_unlink(pool->name);
+	pool->created = 0;
+	return 1;
+}
+
+/*
+Function multiplies two matrices with the tiles of the product shared out
+between worker processes. Returns 0 if the workers could not be used.
+*/
+int shard_multiply(long double *matrix1, long double *matrix2, long double *multiplied, int *size1, int *size2, int workers){
+	struct pool pool;
+	int64_t m = size1[0], k = size1[1], n = size2[1];
+	if(!pool_start(&pool, workers, m, k, n, 1)){
+		return 0;
+	}
+	struct shm_header *h = pool.header;
+	memcpy(pool.base + h->a, matrix1, m*k*sizeof(long double));
+	memcpy(pool.base + h->b, matrix2, k*n*sizeof(long double));
+
+	int64_t tiles_down = (m + SHARD_TILE-1)/SHARD_TILE, tiles_across = (n + SHARD_TILE-1)/SHARD_TILE;
+	int njobs = tiles_down*tiles_across;
+	struct message *jobs = calloc(njobs, sizeof(struct message));
+	for(int t = 0; t < njobs; t++){
+		int64_t ti = t/tiles_across, tj = t%tiles_across;
+		jobs[t].type = MSG_MULTIPLY;
+		jobs[t].arg[0] = ti*SHARD_TILE;
+		jobs[t].arg[1] = (ti+1)*SHARD_TILE < m ? (ti+1)*SHARD_TILE : m;
+		jobs[t].arg[2] = tj*SHARD_TILE;
+		jobs[t].arg[3] = (tj+1)*SHARD_TILE < n ? (tj+1)*SHARD_TILE : n;
+	}
+	int ok = farm_out(&pool, jobs, njobs);
+	if(!ok){
+		printf("A worker failed, multiplying here instead\n");
+	}
+	if(ok){
+		memcpy(multiplied, pool.base + h->c, m*n*sizeof(long double));
+	}
+	free(jobs);
+	pool_stop(&pool);
+	return ok;
+}
+
+/*
+Function inverts a matrix with a blocked LU factorisation. The coordinator
+factorises each panel of SHARD_PANEL columns and works out the block row of U
+to its right, then the workers update the rest of the matrix in slices of
+rows. Once factorised the workers each solve for a slice of the columns of the
+inverse. Returns 0 if the workers could not be used.
+*/
+int shard_inverse(long double *matrix, long double *inverse_mat, int n, int workers, long double *det){
+	struct pool pool;
+	if(!pool_start(&pool, workers, n, n, n, 0)){
+		return 0;
+	}
+	struct shm_header *h = pool.header;
+	long double *lu = (long double *)(pool.base + h->a);
+	long double *x = (long double *)(pool.base + h->c);
+	int *perm = malloc(n*sizeof(int));
+	int slices = 4*workers;/*more jobs than workers so they all stay busy*/
+	struct message *jobs = calloc(slices, sizeof(struct message));
+	int sign = 1, ok = 1;
+	*det = NAN;
+	memcpy(lu, matrix, (size_t)n*n*sizeof(long double));
+
+	for(int k0 = 0; k0 < n && ok; k0 += SHARD_PANEL){
+		int kb = (n-k0 < SHARD_PANEL) ? n-k0 : SHARD_PANEL;
+		/*factorise the panel, swapping whole rows*/
+		for(int k = k0; k < k0+kb; k++){
+			int p = k;
+			for(int i = k+1; i < n; i++){
+				if(fabsl(lu[(size_t)n*i+k]) > fabsl(lu[(size_t)n*p+k])){
+					p = i;
+				}
+			}
+			perm[k] = p;
+			if(p != k){
+				for(int j = 0; j < n; j++){
+					long double t = lu[(size_t)n*k+j];
+					lu[(size_t)n*k+j] = lu[(size_t)n*p+j];
+					lu[(size_t)n*p+j] = t;
+				}
+				sign = -sign;
+			}
+			long double piv = lu[(size_t)n*k+k];
+			if(piv == 0.0){
+				continue;
+			}
+			for(int i = k+1; i < n; i++){
+				long double f = lu[(size_t)n*i+k]/piv;
+				lu[(size_t)n*i+k] = f;
+				for(int j = k+1; j < k0+kb; j++){
+					lu[(size_t)n*i+j] -= f*lu[(size_t)n*k+j];
+				}
+			}
+		}
+		/*U12 = L11^-1 A12*/
+		for(int k = k0; k < k0+kb; k++){
+			for(int i = k+1; i < k0+kb; i++){
+				long double f = lu[(size_t)n*i+k];
+				for(int j = k0+kb; j < n; j++){
+					lu[(size_t)n*i+j] -= f*lu[(size_t)n*k+j];
+				}
+			}
+		}
+		/*A22 = A22 - L21 U12 by the workers*/
+		int rows = n - (k0+kb);
+		if(rows > 0){
+			int njobs = (rows < slices) ? rows : slices;
+			for(int s = 0; s < njobs; s++){
+				jobs[s].type = MSG_UPDATE;
+				jobs[s].arg[0] = k0;
+				jobs[s].arg[1] = kb;
+				jobs[s].arg[2] = k0+kb + (int64_t)rows*s/njobs;
+				jobs[s].arg[3] = k0+kb + (int64_t)rows*(s+1)/njobs;
+			}
+			ok = farm_out(&pool, jobs, njobs);
+		}
+	}
+
+	if(ok){
+		*det = sign;
+		for(int k = 0; k < n; k++){
+			*det *= lu[(size_t)n*k+k];
+		}
+		/*singular matrices are left to inverse() to report*/
+		ok = (*det != 0.0);
+	}
+	if(ok){
+		/*X starts as P I, then the workers solve for slices of its columns*/
+		memset(x, 0, (size_t)n*n*sizeof(long double));
+		for(int k = 0; k < n; k++){
+			x[(size_t)n*k+k] = 1.0;
+		}
+		for(int k = 0; k < n; k++){
+			if(perm[k] != k){
+				for(int j = 0; j < n; j++){
+					long double t = x[(size_t)n*k+j];
+					x[(size_t)n*k+j] = x[(size_t)n*perm[k]+j];
+					x[(size_t)n*perm[k]+j] = t;
+				}
+			}
+		}
+		int njobs = (n < slices) ? n : slices;
+		for(int s = 0; s < njobs; s++){
+			jobs[s].type = MSG_SOLVE;
+			jobs[s].arg[0] = (int64_t)n*s/njobs;
+			jobs[s].arg[1] = (int64_t)n*(s+1)/njobs;
+		}
+		ok = farm_out(&pool, jobs, njobs);
+	}
+	if(!ok && *det != 0.0){
+		printf("A worker failed, inverting here instead\n");
+	}
+	if(ok){
+		memcpy(inverse_mat, x, (size_t)n*n*sizeof(long double));
+	}
+	free(perm);
+	free(jobs);
+	pool_stop(&pool);
+	return ok;
+}
+
+/*
+======================================================================================================
+Batch mode over a manifest of jobs.
+
+The manifest is read into a list of jobs up front and a pool of threads takes
+the next job from it until there are none left. Each thread has its own set
+of buffers that grow to the biggest matrices it has seen, so a run over many
+files of similar size only allocates at the start.
+======================================================================================================
+*/
+
+/*One line of the manifest*/
+struct job {
+	char op;
+	unsigned long long exponent;/*for p*/
+	char *input1, *input2, *output;
+	int line;
+};
+
+/*The list of jobs shared by the threads*/
+struct job_list {
+	struct job *jobs;
+	int count;
+	int next;/*first job not yet taken*/
+	int failed;
+	pthread_mutex_t lock;
+	int argc;
+	char **argv;
+};
+
+/*Buffers kept by one thread between jobs*/
+#define SCRATCH_SLOTS 4
+struct scratch {
+	long double *buf[SCRATCH_SLOTS];
+	size_t space[SCRATCH_SLOTS];
+};
+
+/*Function returns buffer 'slot' with room for at least count values*/
+static long double *scratch_get(struct scratch *sc, int slot, size_t count){
+	if(count > sc->space[slot]){
+		long double *bigger = realloc(sc->buf[slot], count*sizeof(long double));
+		if(bigger == NULL){
+			return NULL;
+		}
+		sc->buf[slot] = bigger;
+		sc->space[slot] = count;
+	}
+	return sc->buf[slot];
+}
+
+/*
+Function reads the manifest into a list of jobs. Returns the number of jobs,
+or -1 if a line can't be understood, which is reported with its line number.
+*/
+static int read_manifest(char *manifest_file, struct job **jobs){
+	FILE *fp = fopen(manifest_file, "r");
+	char line[3*FILENAME_MAX];
+	int count = 0, space = 0, line_no = 0, broken = 0;
+	*jobs = NULL;
+	if(fp == NULL){
+		printf("File could not open %s\n", manifest_file);
+		return -1;
+	}
+	while(!broken && fgets(line, sizeof(line), fp) != NULL){
+		char *word[4];
+		int words = 0;/*all the words on the line, although only four are kept*/
+		line_no++;
+		if(strchr(line, '\n') == NULL && !feof(fp)){
+			printf("Line %d of %s is too long\n", line_no, manifest_file);
+			broken = 1;
+			break;
+		}
+		for(char *w = strtok(line, " \t\r\n"); w != NULL; w = strtok(NULL, " \t\r\n")){
+			if(words < 4){
+				word[words] = w;
+			}
+			words++;
+		}
+		if(words == 0 || word[0][0] == '#'){
+			continue;
+		}
+		struct job job = {0, 0, NULL, NULL, NULL, line_no};
+		char *op = word[0] + (word[0][0] == '-');
+		char *end = NULL;
+		if(op[0] == 'p'){
+			job.exponent = strtoull(op+1, &end, 10);
+			broken = (end == op+1 || *end != '\0');
+		}else{
+			broken = (op[0] == '\0' || op[1] != '\0' || strchr("ftmdais", op[0]) == NULL);
+		}
+		int two_inputs = (op[0] == 'm' || op[0] == 's');
+		if(broken || words != (two_inputs ? 4 : 3)){
+			printf("Line %d of %s should be: op input1 [input2] output\n", line_no, manifest_file);
+			broken = 1;
+			break;
+		}
+		job.op = op[0];
+		job.input1 = strdup(word[1]);
+		job.input2 = two_inputs ? strdup(word[2]) : NULL;
+		job.output = strdup(word[words-1]);
+		if(count == space){
+			space = space ? 2*space : 64;
+			*jobs = realloc(*jobs, space*sizeof(struct job));
+		}
+		(*jobs)[count++] = job;
+	}
+	fclose(fp);
+	if(broken){
+		for(int k = 0; k < count; k++){
+			free((*jobs)[k].input1);
+			free((*jobs)[k].input2);
+			free((*jobs)[k].output);
+		}
+		free(*jobs);
+		*jobs = NULL;
+		return -1;
+	}
+	return count;
+}
+
+/*Function loads the single matrix in a file into scratch buffer 'slot'*/
+static long double *load_matrix(char *filename, int *size, struct shape *hint, struct scratch *sc, int slot){
+	struct input in;
+	long double *matrix = NULL;
+	if(!open_input(&in, filename)){
+		return NULL;
+	}
+	if(get_size(&in, size, hint)){
+		matrix = scratch_get(sc, slot, (size_t)size[0]*size[1]);
+		if(matrix != NULL && !get_matrix(&in, size, matrix)){
+			matrix = NULL;
+		}else if(matrix != NULL && more_blocks(&in)){
+			printf("%s holds several matrices, which --batch doesn't do\n", filename);
+			matrix = NULL;
+		}
+	}
+	close_input(&in);
+	return matrix;
+}
+
+/*Function writes a single value as a comment line, for -f and -d*/
+static int print_value(char *output_file, const char *name, long double value, int argc, char **argv){
+	FILE *fp = fopen(output_file, "w");
+	if(fp == NULL){
+		printf("Could not open %s for writing\n", output_file);
+		return 0;
+	}
+	print_header(fp, argc, argv);
+	fprintf(fp, "# %s = %.21Lg\n", name, value);
+	return fclose(fp) == 0;
+}
+
+/*Function carries out one job, returning 1 if it worked*/
+static int run_job(struct job *job, struct scratch *sc, int argc, char **argv){
+	int size1[2], size2[2];
+	struct shape hint = {STRUCT_UNKNOWN, 0, 0};
+	long double *matrix1 = load_matrix(job->input1, size1, &hint, sc, 0);
+	long double *matrix2 = NULL;
+	if(matrix1 == NULL){
+		return 0;
+	}
+	if(job->input2 != NULL && (matrix2 = load_matrix(job->input2, size2, NULL, sc, 1)) == NULL){
+		return 0;
+	}
+	int square = (size1[0] == size1[1]);
+	int n = size1[0];
+	size_t nn = (size_t)size1[0]*size1[1];
+	switch(job->op){
+		case 'f':
+			return print_value(job->output, "Frobenius norm", frobenius(matrix1, size1), argc, argv);
+		case 't':{
+			long double *tranmatrix = scratch_get(sc, 2, nn);
+			int sizet[2] = {size1[1], size1[0]};
+			if(tranmatrix == NULL){
+				return 0;
+			}
+			transpose(matrix1, tranmatrix, size1);
+			print_file(tranmatrix, sizet, job->output, argc, argv);
+			return 1;
+		}
+		case 'm':{
+			int sizem[2] = {size1[0], size2[1]};
+			long double *multiplied = scratch_get(sc, 2, (size_t)sizem[0]*sizem[1]);
+			if(size1[1] != size2[0]){
+				printf("%s and %s can not be multiplied\n", job->input1, job->input2);
+				return 0;
+			}
+			if(multiplied == NULL){
+				return 0;
+			}
+			multiply(matrix1, matrix2, multiplied, size1, size2);
+			print_file(multiplied, sizem, job->output, argc, argv);
+			return 1;
+		}
+		case 's':{
+			long double *solution = scratch_get(sc, 2, (size_t)size2[0]*size2[1]);
+			if(!square || size2[0] != n){
+				printf("%s must be square with as many rows as %s\n", job->input1, job->input2);
+				return 0;
+			}
+			if(solution == NULL){
+				return 0;
+			}
+			solve(matrix1, matrix2, solution, n, size2[1]);
+			print_file(solution, size2, job->output, argc, argv);
+			return 1;
+		}
+		default:
+			break;
+	}
+
+	/*the rest only work on square matrices*/
+	if(!square){
+		printf("%s must be square\n", job->input1);
+		return 0;
+	}
+	struct shape shape;
+	long double *result = scratch_get(sc, 2, nn);
+	if(result == NULL){
+		return 0;
+	}
+	if(job->op == 'd'){
+		find_shape(matrix1, n, &hint, &shape);
+		return print_value(job->output, "Determinant", determinant(matrix1, n, &shape), argc, argv);
+	}
+	if(job->op == 'a'){
+		adjoint(matrix1, result, n);
+		print_file(result, size1, job->output, argc, argv);
+		return 1;
+	}
+	if(job->op == 'i'){
+		find_shape(matrix1, n, &hint, &shape);
+		long double det = inverse(matrix1, result, n, &shape);
+		print_exact_file(result, size1, det, job->output, argc, argv);
+		return 1;
+	}
+	/*p, matrix1 and two more buffers are used up by the squaring*/
+	long double *work = scratch_get(sc, 3, nn);
+	if(work == NULL){
+		return 0;
+	}
+	print_file(power(matrix1, result, work, n, job->exponent), size1, job->output, argc, argv);
+	return 1;
+}
+
+/*Function run by each thread of the pool, taking jobs until there are none left*/
+static void *batch_thread(void *arg){
+	struct job_list *list = arg;
+	struct scratch sc;
+	memset(&sc, 0, sizeof(sc));
+	for(;;){
+		pthread_mutex_lock(&list->lock);
+		int k = list->next++;
+		pthread_mutex_unlock(&list->lock);
+		if(k >= list->count){
+			break;
+		}
+		struct job *job = &list->jobs[k];
+		if(!run_job(job, &sc, list->argc, list->argv)){
+			printf("Job on line %d (%s) failed\n", job->line, job->input1);
+			pthread_mutex_lock(&list->lock);
+			list->failed++;
+			pthread_mutex_unlock(&list->lock);
+		}
+	}
+	for(int slot = 0; slot < SCRATCH_SLOTS; slot++){
+		free(sc.buf[slot]);
+	}
+	return NULL;
+}
+
+/*
+Function carries out every job in a manifest on a pool of threads.
+Returns the number of jobs that worked.
+*/
+int run_batch(char *manifest_file, int jobs, int argc, char **argv){
+	struct job_list list;
+	list.count = read_manifest(manifest_file, &list.jobs);
+	if(list.count < 0){
+		return 0;
+	}
+	list.next = 0;
+	list.failed = 0;
+	list.argc = argc;
+	list.argv = argv;
+	pthread_mutex_init(&list.lock, NULL);
+	quiet = 1;
+
+	if(jobs > list.count){
+		jobs = (list.count > 0) ? list.count : 1;
+	}
+	/*the jobs share the processors when unpacking*/
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	decode_threads = (cpus > jobs) ? cpus/jobs : 1;
+	pthread_t *threads = malloc(jobs*sizeof(pthread_t));
+	int started = 0;
+	for(int t = 0; t < jobs; t++){
+		if(pthread_create(&threads[t], NULL, batch_thread, &list) != 0){
+			break;
+		}
+		started++;
+	}
+	if(started == 0){
+		/*no threads could be made, so do the work here*/
+		batch_thread(&list);
+	}
+	for(int t = 0; t < started; t++){
+		pthread_join(threads[t], NULL);
+	}
+	printf("%d jobs done, %d failed\n", list.count - list.failed, list.failed);
+
+	for(int k = 0; k < list.count; k++){
+		free(list.jobs[k].input1);
+		free(list.jobs[k].input2);
+		free(list.jobs[k].output);
+	}
+	free(list.jobs);
+	free(threads);
+	pthread_mutex_destroy(&list.lock);
+	return list.count - list.failed;
+}
+
+/*
+======================================================================================================
+Packed matrix files.
+
+The format and its codec are in mat_pack.h, shared with mat_gen. Here the
+blocks of a file are read in and unpacked on several threads at once.
+======================================================================================================
+*/
+
+/*
+Function writes a matrix packed. Values are written as doubles, so results
+kept in long double lose their last few digits.
+*/
+void write_packed(char *filename, long double *matrix, int *size){
+	struct pack_header h;
+	struct pack_footer f;
+	FILE *fp = fopen(filename, "wb");
+	if(fp == NULL){
+		printf("Could not open %s for writing\n", filename);
+		return;
+	}
+	pack_start(&h, size[0], size[1]);
+
+	size_t most = h.block_rows*h.cols;/*values in a full block*/
+	double *values = malloc(most*sizeof(double));
+	uint8_t *shuffled = malloc(most*sizeof(double));
+	uint8_t *packed = malloc(most*sizeof(double));
+	uint64_t *offsets = malloc(h.blocks*sizeof(uint64_t));
+	uint64_t written = sizeof(h);
+	int ok = (values != NULL && shuffled != NULL && packed != NULL && offsets != NULL);
+	ok = ok && fwrite(&h, sizeof(h), 1, fp) == 1;
+
+	for(uint64_t b = 0; ok && b < h.blocks; b++){
+		uint64_t row0 = b*h.block_rows;
+		uint64_t rows = (h.rows - row0 < h.block_rows) ? h.rows - row0 : h.block_rows;
+		size_t count = rows*h.cols;
+		for(size_t k = 0; k < count; k++){
+			values[k] = matrix[row0*h.cols + k];
+		}
+		struct pack_frame frame;
+		const uint8_t *data = pack_values(values, count, shuffled, packed, &frame);
+		offsets[b] = written;
+		ok = fwrite(&frame, sizeof(frame), 1, fp) == 1 && fwrite(data, 1, frame.packed_size, fp) == frame.packed_size;
+		written += sizeof(frame) + frame.packed_size;
+	}
+	memset(&f, 0, sizeof(f));
+	f.table_offset = written;
+	memcpy(f.magic, PACK_END_MAGIC, sizeof(f.magic));
+	ok = ok && fwrite(offsets, sizeof(uint64_t), h.blocks, fp) == h.blocks;
+	ok = ok && fwrite(&f, sizeof(f), 1, fp) == 1;
+	if(fclose(fp) != 0 || !ok){
+		printf("Could not write %s\n", filename);
+	}
+	free(values);
+	free(shuffled);
+	free(packed);
+	free(offsets);
+}
+
+/*A block read in and waiting to be unpacked*/
+struct pack_block {
+	uint64_t number;
+	size_t at;/*where its data starts in the buffer*/
+	struct pack_frame frame;
+};
+
+/*Work shared by the threads unpacking blocks*/
+struct unpack_work {
+	struct pack_header *h;
+	uint8_t *data;
+	struct pack_block *blocks;
+	int count;
+	int next;
+	int failed;
+	pthread_mutex_t lock;
+	int *range;
+	long double *matrix;
+};
+
+/*Function run by each unpacking thread, taking blocks until there are none left*/
+static void *unpack_thread(void *arg){
+	struct unpack_work *w = arg;
+	struct pack_header *h = w->h;
+	/*get_size has checked the header, but the buffer size is checked again here*/
+	uint64_t block_rows = (h->block_rows < h->rows) ? h->block_rows : h->rows;
+	size_t most = 0;
+	uint8_t *raw = NULL;
+	double *values = malloc(h->cols*sizeof(double));/*a row, before it is made long double*/
+	if(h->cols <= UINT32_MAX/sizeof(double)/block_rows){
+		most = block_rows*h->cols*sizeof(double);
+		raw = malloc(most + PACK_SLACK);
+	}
+	int failed = (raw == NULL || values == NULL);
+	for(;;){
+		pthread_mutex_lock(&w->lock);
+		int k = w->next++;
+		w->failed += failed;
+		pthread_mutex_unlock(&w->lock);
+		failed = 0;
+		if(k >= w->count || raw == NULL || values == NULL){
+			break;
+		}
+		struct pack_block *b = &w->blocks[k];
+		uint64_t row0 = b->number*h->block_rows;
+		uint64_t rows = (h->rows - row0 < h->block_rows) ? h->rows - row0 : h->block_rows;
+		size_t count = rows*h->cols;
+		const uint8_t *shuffled = w->data + b->at;
+		if(b->frame.raw_size > most || b->frame.raw_size != count*sizeof(double) || b->frame.packed_size > b->frame.raw_size){
+			failed = 1;
+			continue;
+		}
+		if(b->frame.packed_size < b->frame.raw_size){
+			if(!lz_decompress(shuffled, b->frame.packed_size, raw, b->frame.raw_size)){
+				failed = 1;
+				continue;
+			}
+			shuffled = raw;
+		}
+		/*copy out the part of each row that is wanted*/
+		int *range = w->range;
+		int cols = range[3] - range[2];
+		for(uint64_t r = 0; r < rows; r++){
+			int64_t i = (int64_t)(row0 + r) - range[0];
+			if(i < 0 || i >= range[1] - range[0]){
+				continue;
+			}
+			long double *out = w->matrix + (size_t)cols*i;
+			unshuffle_bytes(shuffled, count, r*h->cols + range[2], cols, values);
+			for(int j = 0; j < cols; j++){
+				out[j] = values[j];
+			}
+		}
+	}
+	free(values);
+	free(raw);
+	return NULL;
+}
+
+/*
+Function reads the frame and data of block b->number onto the end of the
+buffer. The sizes in the frame are checked against the rows the block must
+hold before the buffer is grown, so a broken frame can't ask for any more.
+*/
+static int read_block(FILE *fp, struct pack_header *h, uint8_t **data, size_t *used, size_t *space, struct pack_block *b){
+	uint64_t row0 = b->number*h->block_rows;
+	uint64_t rows = (h->rows - row0 < h->block_rows) ? h->rows - row0 : h->block_rows;
+	if(b->number >= h->blocks || fread(&b->frame, sizeof(b->frame), 1, fp) != 1
+	|| b->frame.raw_size != rows*h->cols*sizeof(double) || b->frame.packed_size > b->frame.raw_size){
+		return 0;
+	}
+	if(*used + b->frame.packed_size + PACK_SLACK > *space){
+		size_t bigger = 2*(*space) + b->frame.packed_size + PACK_SLACK;
+		uint8_t *grown = realloc(*data, bigger);
+		if(grown == NULL){
+			return 0;
+		}
+		*data = grown;
+		*space = bigger;
+	}
+	b->at = *used;
+	if(fread(*data + *used, 1, b->frame.packed_size, fp) != b->frame.packed_size){
+		return 0;
+	}
+	*used += b->frame.packed_size;
+	return 1;
+}
+
+/*
+Function loads rows range[0] to range[1]-1 and columns range[2] to range[3]-1
+of a packed matrix whose header has just been read. Only the blocks holding
+those rows are unpacked. A file on disk is seeked to the first of them using
+the table at its end, anything else is read through up to them. The blocks
+are then unpacked on as many threads as there are processors, or on
+decode_threads of them in --batch mode.
+Returns 0 if the part couldn't be read.
+*/
+int unpack_rows(struct input *in, int *range, long double *matrix){
+	struct pack_header *h = &in->pack;
+	uint64_t first = range[0]/h->block_rows, last = (range[1]-1)/h->block_rows;
+	int count = last - first + 1;
+	struct pack_block *blocks = malloc(count*sizeof(struct pack_block));
+	uint8_t *data = NULL;
+	size_t used = 0, space = 0;
+	struct stat st;
+	int ok = (blocks != NULL);
+
+	/*find the first block wanted*/
+	uint64_t b = 0;
+	if(ok && first > 0 && in->fp != stdin && fstat(fileno(in->fp), &st) == 0 && S_ISREG(st.st_mode)){
+		struct pack_footer f;
+		uint64_t offset;
+		if(fseek(in->fp, -(long)sizeof(f), SEEK_END) == 0 && fread(&f, sizeof(f), 1, in->fp) == 1
+		&& memcmp(f.magic, PACK_END_MAGIC, sizeof(f.magic)) == 0
+		&& fseek(in->fp, f.table_offset + first*sizeof(uint64_t), SEEK_SET) == 0
+		&& fread(&offset, sizeof(offset), 1, in->fp) == 1){
+			ok = (fseek(in->fp, offset, SEEK_SET) == 0);
+			b = first;
+		}else{
+			ok = (fseek(in->fp, sizeof(*h), SEEK_SET) == 0);
+		}
+	}
+	for(; ok && b < first; b++){
+		/*skip blocks before the part by reading them into the buffer and dropping them*/
+		struct pack_block skipped;
+		skipped.number = b;
+		ok = read_block(in->fp, h, &data, &used, &space, &skipped);
+		used = 0;
+	}
+	for(int k = 0; ok && k < count; k++){
+		blocks[k].number = first + k;
+		ok = read_block(in->fp, h, &data, &used, &space, &blocks[k]);
+	}
+
+	if(ok){
+		struct unpack_work w = {h, data, blocks, count, 0, 0, PTHREAD_MUTEX_INITIALIZER, range, matrix};
+		long cpus = (decode_threads > 0) ? decode_threads : sysconf(_SC_NPROCESSORS_ONLN);
+		int threads = (cpus < count) ? (int)cpus : count;
+		pthread_t *tid = malloc(threads*sizeof(pthread_t));
+		int started = 0;
+		for(int t = 1; tid != NULL && t < threads; t++){
+			if(pthread_create(&tid[t], NULL, unpack_thread, &w) != 0){
+				break;
+			}
+			started++;
+		}
+		unpack_thread(&w);/*this thread helps too*/
+		for(int t = 1; t <= started; t++){
+			pthread_join(tid[t], NULL);
+		}
+		free(tid);
+		ok = (w.failed == 0);
+	}
+	free(blocks);
+	free(data);
+	if(!ok){
+		printf("Could not read matrix from %s\n", in->name);
+	}
+	return ok;
 }
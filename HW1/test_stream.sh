@@ -0,0 +1,35 @@
+#!/bin/sh
+# Checks that mat_test -d gives each block of a stream the same determinant
+# as it gets on its own, when blocks with and without a '# Structure' comment
+# are mixed, so that one block's structure can't be used for another.
+#   sh test_stream.sh
+set -e
+here=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+cd "$work"
+gcc -O2 "$here/mat_gen.c" -o mat_gen -lm
+gcc -O2 "$here/mat_test.c" -o mat_test -lm -pthread
+
+# 20 x 20 is above the batch kernel sizes, so the structure is used
+./mat_gen -r 20 -c 20 --seed 3 --file general.txt > /dev/null
+./mat_gen -r 20 -c 20 --seed 4 --structure diagonal --min 1 --max 2 --file diag.txt > /dev/null
+./mat_gen -r 20 -c 20 --seed 5 --structure upper --min 1 --max 2 --file upper.txt > /dev/null
+
+alone() {
+	./mat_test -d "$1" | sed -n 's/^determinant is \([^ ]*\).*/\1/p'
+}
+
+failed=0
+for order in "general.txt diag.txt" "diag.txt general.txt" "upper.txt general.txt diag.txt general.txt"; do
+	expected=$(for f in $order; do echo $(alone "$f"); done)
+	got=$(cat $order | ./mat_test -d - | grep -v 'contains matrix')
+	if [ "$expected" != "$got" ]; then
+		echo "FAIL: $order"
+		echo "expected:" $expected
+		echo "got:     " $got
+		failed=1
+	fi
+done
+[ $failed -eq 0 ] && echo "stream structure hints OK"
+exit $failed